@@ -29,6 +29,7 @@ _rgbasm_completions() {
 		[v]="verbose:normal"
 		[w]=":normal"
 		[b]="binary-digits:unk"
+		[C]="cache-dir:dir"
 		[D]="define:unk"
 		[g]="gfx-chars:unk"
 		[I]="include:dir"
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef RGBDS_ASM_CACHE_H
+#define RGBDS_ASM_CACHE_H
+
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+void cache_SetDirectory(std::string const &path);
+void cache_AddOption(int option, char const *arg);
+void cache_DisableStore(char const *reason);
+void cache_RecordFile(std::string const &path, std::optional<std::string> const &fullPath);
+bool cache_Replay(std::string const &mainPath);
+void cache_Store(std::vector<uint8_t> const &object);
+
+#endif // RGBDS_ASM_CACHE_H
@@ -20,8 +20,8 @@
 struct FileStackNode {
 	FileStackNodeType type;
 	std::variant<
-	    std::vector<uint32_t>, // NODE_REPT
-	    std::string            // NODE_FILE, NODE_MACRO
+	    std::vector<uint32_t>,             // NODE_REPT
+	    std::shared_ptr<std::string const> // NODE_FILE, NODE_MACRO (shared by a macro's nodes)
 	    >
 	    data;
 
@@ -37,11 +37,13 @@ struct FileStackNode {
 	std::vector<uint32_t> &iters();
 	std::vector<uint32_t> const &iters() const;
 	// File name for files, file::macro name for macros
-	std::string &name();
 	std::string const &name() const;
 
-	FileStackNode(FileStackNodeType type_, std::variant<std::vector<uint32_t>, std::string> data_)
-	    : type(type_), data(data_){};
+	FileStackNode(
+	    FileStackNodeType type_,
+	    std::variant<std::vector<uint32_t>, std::shared_ptr<std::string const>> data_
+	)
+	    : type(type_), data(std::move(data_)){};
 
 	std::string const &dump(uint32_t curLineNo) const;
 
@@ -61,6 +63,7 @@ MacroArgs *fstk_GetCurrentMacroArgs();
 
 void fstk_AddIncludePath(std::string const &path);
 void fstk_SetPreIncludeFile(std::string const &path);
+std::optional<std::string> const &fstk_ResolveFile(std::string const &path);
 std::optional<std::string> fstk_FindFile(std::string const &path);
 
 bool yywrap();
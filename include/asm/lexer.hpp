@@ -13,11 +13,10 @@
 
 #include "platform.hpp" // SSIZE_MAX
 
-#define LEXER_BUF_SIZE 128
-// The buffer needs to be large enough for the maximum `lexerState->peek()` lookahead distance
-static_assert(LEXER_BUF_SIZE > 1, "Lexer buffer size is too small");
-// This caps the size of buffer reads, and according to POSIX, passing more than SSIZE_MAX is UB
-static_assert(LEXER_BUF_SIZE <= SSIZE_MAX, "Lexer buffer size is too large");
+// Initial size of reads from files that cannot be mapped (such as stdin)
+#define LEXER_READ_SIZE 4096
+// According to POSIX, passing more than SSIZE_MAX to `read` is UB
+static_assert(LEXER_READ_SIZE <= SSIZE_MAX, "Lexer read size is too large");
 
 enum LexerMode {
 	LEXER_NORMAL,
@@ -54,27 +53,19 @@ struct ViewedContent {
 	}
 };
 
-struct BufferedContent {
-	int fd;                        // File from which to read chars
-	char buf[LEXER_BUF_SIZE] = {}; // Circular buffer of chars
-	size_t offset = 0;             // Cursor into `buf`
-	size_t size = 0;               // Number of "fresh" chars in `buf`
-
-	BufferedContent(int fd_) : fd(fd_) {}
-	~BufferedContent();
-
-	void advance(); // Increment `offset` circularly, decrement `size`
-	void refill();  // Read from `fd` to fill `buf`
-
-private:
-	size_t readMore(size_t startIndex, size_t nbChars);
-};
-
 struct IfStackEntry {
 	bool ranIfBlock;       // Whether an IF/ELIF/ELSE block ran already
 	bool reachedElseBlock; // Whether an ELSE block ran already
 };
 
+enum IncludeGuardState {
+	GUARD_NONE,     // Not (or no longer) possibly wrapped in an include guard
+	GUARD_MATCHING, // Lexing the `IF !DEF(name)` line that may start an include guard
+	GUARD_OPEN,     // Inside the include guard's `IF` block
+	GUARD_CLOSED,   // Past the include guard's `ENDC`
+	GUARD_COMPLETE, // Reached EOF with nothing but newlines after the include guard
+};
+
 struct LexerState {
 	std::string path;
 
@@ -86,8 +77,9 @@ struct LexerState {
 
 	std::deque<IfStackEntry> ifStack;
 
-	bool capturing;     // Whether the text being lexed should be captured
-	size_t captureSize; // Amount of text captured
+	bool capturing;           // Whether the text being lexed should be captured
+	size_t captureSize;       // Amount of text captured
+	ContentSpan captureSlice; // Contents that the text captured so far starts, if in one piece
 	std::shared_ptr<std::vector<char>> captureBuf; // Buffer to send the captured text to if set
 
 	bool disableMacroArgs;
@@ -96,7 +88,11 @@ struct LexerState {
 	bool expandStrings;
 	std::deque<Expansion> expansions; // Front is the innermost current expansion
 
-	std::variant<std::monostate, ViewedContent, BufferedContent> content;
+	std::variant<std::monostate, ViewedContent> content;
+
+	IncludeGuardState guardState;
+	size_t guardTokensMatched; // How much of the `IF !DEF(name)` line was lexed so far
+	std::string guardName;     // Symbol checked by the include guard, if any
 
 	~LexerState();
 
@@ -145,6 +141,9 @@ void lexer_ReachELSEBlock();
 void lexer_CheckRecursionDepth();
 uint32_t lexer_GetLineNo();
 uint32_t lexer_GetColNo();
+uint64_t lexer_GetNbMovedStrings();
+// Files that cannot be mapped are only read up to `maxSize` bytes
+std::optional<ContentSpan> lexer_ReadFile(std::string const &path, size_t maxSize);
 void lexer_DumpStringExpansions();
 
 struct Capture {
@@ -6,6 +6,7 @@
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "linkdefs.hpp"
 
@@ -21,5 +22,6 @@ void out_CreateAssert(
     AssertionType type, Expression const &expr, std::string const &message, uint32_t ofs
 );
 void out_WriteObject();
+void out_WriteObjectData(std::vector<uint8_t> const &data);
 
 #endif // RGBDS_ASM_OUTPUT_H
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: MIT */
+
+#ifndef RGBDS_ASM_ROPE_H
+#define RGBDS_ASM_ROPE_H
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+
+struct RopeNode;
+
+// Strings are kept as trees of pieces, so that concatenating them does not copy any characters;
+// they are only flattened into a contiguous `std::string` once their characters are needed.
+// This keeps accumulating a string (e.g. `REDEF S EQUS STRCAT("{S}", ...)`) linear.
+// Nodes are immutable, so subtrees can be shared between strings.
+struct Rope {
+	std::shared_ptr<RopeNode const> root{}; // `nullptr` for the empty string
+
+	Rope() = default;
+	Rope(std::string &&str);
+	Rope(std::string const &str);
+	Rope(std::shared_ptr<std::string> str); // Shares `str` instead of copying it
+
+	bool empty() const { return !root; }
+	size_t length() const;
+
+	Rope &operator+=(Rope const &other);
+
+	std::string const &str() const; // Flattens the string if needed
+	std::shared_ptr<std::string> sharedStr() const;
+};
+
+#endif // RGBDS_ASM_ROPE_H
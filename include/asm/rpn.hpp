@@ -3,23 +3,42 @@
 #ifndef RGBDS_ASM_RPN_H
 #define RGBDS_ASM_RPN_H
 
+#include <memory>
 #include <stdint.h>
 #include <string>
 #include <variant>
-#include <vector>
 
 #include "linkdefs.hpp"
 
 struct Symbol;
 
+// Unknown expressions are kept as trees, which are only serialized when creating a patch.
+// Nodes are immutable, so subtrees can be shared between expressions.
+struct RPNNode {
+	RPNCommand command;
+	std::variant<
+	    std::monostate, // For operators and `RPN_BANK_SELF`
+	    uint32_t,       // For `RPN_CONST` and section types
+	    Symbol *,       // For `RPN_SYM` and `RPN_BANK_SYM`
+	    std::string     // Section name for `RPN_BANK_SECT`, `RPN_SIZEOF_SECT`...
+	    >
+	    data;
+	std::shared_ptr<RPNNode const> lhs; // Operand of unary operators, or left one of binary ones
+	std::shared_ptr<RPNNode const> rhs; // Right operand of binary operators
+
+	uint32_t value() const;
+	Symbol *symbol() const;
+	std::string const &sectionName() const;
+};
+
 struct Expression {
 	std::variant<
 		int32_t,    // If the expression's value is known, it's here
 		std::string // Why the expression is not known, if it isn't
 	> data = 0;
 	bool isSymbol = false; // Whether the expression represents a symbol suitable for const diffing
-	std::vector<uint8_t> rpn{}; // Bytes serializing the RPN expression
-	uint32_t rpnPatchSize = 0;  // Size the expression will take in the object file
+	std::shared_ptr<RPNNode const> rpn{}; // The RPN expression, if the value is not known
+	uint32_t rpnPatchSize = 0;            // Size the expression will take in the object file
 
 	Expression() = default;
 	Expression(Expression &&) = default;
@@ -39,7 +58,9 @@ struct Expression {
 
 	void makeNumber(uint32_t value);
 	void makeSymbol(std::string const &symName);
+	void makeAnonLabel(uint32_t id);
 	void makeBankSymbol(std::string const &symName);
+	void makeBankAnonLabel(uint32_t id);
 	void makeBankSection(std::string const &sectName);
 	void makeSizeOfSection(std::string const &sectName);
 	void makeStartOfSection(std::string const &sectName);
@@ -59,8 +80,10 @@ struct Expression {
 
 private:
 	void clear();
-	uint8_t *reserveSpace(uint32_t size);
-	uint8_t *reserveSpace(uint32_t size, uint32_t patchSize);
+	void makeUnknownSymbol(Symbol *sym, std::string const &symName);
+	void makeLabelBank(Symbol *sym, std::string const &symName);
+	void makeUnaryOp(RPNCommand op);
+	bool tryFoldOffsets(RPNCommand op, Expression const &src1, Expression const &src2);
 };
 
 #endif // RGBDS_ASM_RPN_H
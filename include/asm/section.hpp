@@ -19,13 +19,14 @@ struct FileStackNode;
 struct Section;
 
 struct Patch {
-	std::shared_ptr<FileStackNode> src;
+	uint32_t nodeID; // ID of the (registered) file stack node where the patch was created
 	uint32_t lineNo;
 	uint32_t offset;
 	Section *pcSection;
 	uint32_t pcOffset;
 	uint8_t type;
-	std::vector<uint8_t> rpn;
+	uint32_t rpnOffset; // Where the RPN expression starts in its owner's buffer
+	uint32_t rpnSize;
 };
 
 struct Section {
@@ -39,7 +40,8 @@ struct Section {
 	uint32_t bank;
 	uint8_t align; // Exactly as specified in `ALIGN[]`
 	uint16_t alignOfs;
-	std::deque<Patch> patches;
+	std::vector<Patch> patches;   // In the order they were created
+	std::vector<uint8_t> patchRPN; // RPN expressions of all `patches`, back to back
 	std::vector<uint8_t> data;
 
 	bool isSizeKnown() const;
@@ -13,6 +13,7 @@
 #include <variant>
 
 #include "asm/lexer.hpp"
+#include "asm/rope.hpp"
 #include "asm/section.hpp"
 
 enum SymbolType {
@@ -24,6 +25,12 @@ enum SymbolType {
 	SYM_REF // Forward reference to a label
 };
 
+struct Macro {
+	ContentSpan span;
+	// Name of the file stack nodes of its invocations, shared by all of them once computed
+	std::shared_ptr<std::string const> contextName;
+};
+
 struct Symbol;                    // For the `sym_IsPC` forward declaration
 bool sym_IsPC(Symbol const *sym); // For the inline `getSection` method
 
@@ -37,10 +44,10 @@ struct Symbol {
 	uint32_t fileLine;                  // Line where the symbol was defined
 
 	std::variant<
-	    int32_t,                     // If isNumeric()
-	    int32_t (*)(),               // If isNumeric() and has a callback
-	    ContentSpan,                 // For SYM_MACRO
-	    std::shared_ptr<std::string> // For SYM_EQUS
+	    int32_t,                // If isNumeric()
+	    int32_t (*)(),          // If isNumeric() and has a callback
+	    std::shared_ptr<Macro>, // For SYM_MACRO
+	    Rope                    // For SYM_EQUS
 	    >
 	    data;
 
@@ -62,8 +69,9 @@ struct Symbol {
 
 	int32_t getValue() const;
 	int32_t getOutputValue() const;
-	ContentSpan const &getMacro() const;
-	std::shared_ptr<std::string> getEqus() const;
+	Macro &getMacro();
+	Macro const &getMacro() const;
+	Rope const &getEqus() const;
 	uint32_t getConstantValue() const;
 };
 
@@ -73,7 +81,11 @@ void sym_SetExportAll(bool set);
 Symbol *sym_AddLocalLabel(std::string const &symName);
 Symbol *sym_AddLabel(std::string const &symName);
 Symbol *sym_AddAnonLabel();
-std::string sym_MakeAnonLabelName(uint32_t ofs, bool neg);
+uint32_t sym_GetAnonLabelID(uint32_t ofs, bool neg);
+// Find an anonymous label by ID
+Symbol *sym_FindAnonLabel(uint32_t id);
+// Find an anonymous label by ID, creating a reference to it if it doesn't exist yet
+Symbol *sym_RefAnonLabel(uint32_t id);
 void sym_Export(std::string const &symName);
 Symbol *sym_AddEqu(std::string const &symName, int32_t value);
 Symbol *sym_RedefEqu(std::string const &symName, int32_t value);
@@ -91,8 +103,8 @@ Symbol *sym_FindScopedValidSymbol(std::string const &symName);
 Symbol const *sym_GetPC();
 Symbol *sym_AddMacro(std::string const &symName, int32_t defLineNo, ContentSpan const &span);
 Symbol *sym_Ref(std::string const &symName);
-Symbol *sym_AddString(std::string const &symName, std::shared_ptr<std::string> value);
-Symbol *sym_RedefString(std::string const &symName, std::shared_ptr<std::string> value);
+Symbol *sym_AddString(std::string const &symName, Rope value);
+Symbol *sym_RedefString(std::string const &symName, Rope value);
 void sym_Purge(std::string const &symName);
 void sym_Init(time_t now);
 
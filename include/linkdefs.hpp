@@ -9,7 +9,8 @@
 #include "helpers.hpp" // assume
 
 #define RGBDS_OBJECT_VERSION_STRING "RGBA"
-#define RGBDS_OBJECT_REV            10U
+#define RGBDS_OBJECT_REV            11U
+#define RGBDS_OBJECT_REV_LEGACY     10U // Last revision without a string table, still readable
 
 enum AssertionType { ASSERT_WARN, ASSERT_ERROR, ASSERT_FATAL };
 
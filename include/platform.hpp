@@ -48,6 +48,25 @@
 	#define O_TEXT   0   // Assume that it's not defined either
 #endif                   // _MSC_VER
 
+// Windows doesn't have `realpath`, but `_fullpath` also makes paths absolute;
+// nor does it have `lstat`, but symbolic links are rare enough there to be ignored
+#ifdef _WIN32
+	#include <stdlib.h> // IWYU pragma: export
+	#define realpath(path, resolved) _fullpath((resolved), (path), _MAX_PATH)
+	#define lstat(path, buf)         stat((path), (buf))
+#endif
+
+// MSVC doesn't have `mkstemp`, so emulate it
+#ifdef _MSC_VER
+	#include <string.h>   // IWYU pragma: export
+	#include <sys/stat.h> // IWYU pragma: export
+static inline int mkstemp(char *tmpl) {
+	if (_mktemp_s(tmpl, strlen(tmpl) + 1) != 0)
+		return -1;
+	return _open(tmpl, _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+#endif
+
 // Windows has stdin and stdout open as text by default, which we may not want
 #if defined(_MSC_VER) || defined(__MINGW32__)
 	#include <io.h> // IWYU pragma: export
@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "asm/cache.hpp"
+#include <sys/stat.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_set>
+
+#include "error.hpp"
+#include "helpers.hpp"
+#include "platform.hpp" // S_ISREG
+#include "version.hpp"
+
+#include "asm/fstack.hpp"
+#include "asm/lexer.hpp"
+#include "asm/main.hpp"
+#include "asm/output.hpp"
+
+// Each cache entry is a file named after a key, hashed from everything that the object file
+// depends on, except for the files found by `fstk_FindFile` (`INCLUDE`, `INCBIN`, etc.).
+// The entry lists those files, what their names resolved to, and their contents' hashes;
+// it is only used if all of them still resolve to the same files with the same contents.
+//
+// Entry layout: "RGBC", the object's hash (8 bytes), the number of files (4 bytes), then for
+// each file its name, whether it was found (1 byte), and if so its full path and hash (8 bytes),
+// with strings NUL-terminated and numbers little-endian; the object file takes up the rest.
+
+struct CachedFile {
+	std::string name;
+	std::optional<std::string> fullPath;
+};
+
+static std::string cacheDir; // Empty if the cache is disabled
+static uint64_t keyHash = 0xCBF29CE484222325; // 64-bit FNV-1a offset basis
+static std::string entryPath;
+
+// Files looked up by `fstk_FindFile`, by order of first lookup
+static std::vector<CachedFile> cachedFiles;
+static std::unordered_set<std::string> cachedFileNames;
+
+// Why the object file must not be cached, if it must not
+static char const *storeDisabledReason = nullptr;
+
+static uint64_t hashBytes(uint64_t hash, char const *data, size_t size) {
+	// 64-bit FNV-1a
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+// Other files (e.g. devices or FIFOs) may never end, or be consumed by reading them
+static bool isHashable(std::string const &path) {
+	struct stat statBuf;
+	return stat(path.c_str(), &statBuf) == 0 && S_ISREG(statBuf.st_mode);
+}
+
+static void hashString(char const *str) {
+	keyHash = hashBytes(keyHash, str, strlen(str) + 1); // Include the NUL as a separator
+}
+
+static void putlong(uint64_t n, size_t size, std::vector<uint8_t> &buf) {
+	for (size_t i = 0; i < size; i++)
+		buf.push_back(n >> (i * 8));
+}
+
+static void putstring(std::string const &s, std::vector<uint8_t> &buf) {
+	buf.insert(buf.end(), s.c_str(), s.c_str() + s.length() + 1);
+}
+
+// Reads entries written by `cache_Store`; any malformed read makes `ok` false
+struct EntryReader {
+	char const *ptr;
+	char const *end;
+	bool ok = true;
+
+	uint64_t getlong(size_t size) {
+		if ((size_t)(end - ptr) < size) {
+			ok = false;
+			return 0;
+		}
+		uint64_t n = 0;
+		for (size_t i = 0; i < size; i++)
+			n |= (uint64_t)(uint8_t)*ptr++ << (i * 8);
+		return n;
+	}
+
+	std::string getstring() {
+		char const *nul = (char const *)memchr(ptr, '\0', end - ptr);
+		if (!nul) {
+			ok = false;
+			return "";
+		}
+		std::string s(ptr, nul);
+		ptr = nul + 1;
+		return s;
+	}
+};
+
+void cache_SetDirectory(std::string const &path) {
+	if (!cacheDir.empty())
+		warnx("Overriding cache directory %s", cacheDir.c_str());
+	cacheDir = path;
+	if (!cacheDir.empty() && cacheDir.back() != '/')
+		cacheDir += '/';
+}
+
+void cache_AddOption(int option, char const *arg) {
+	char opt[] = {(char)option, '\0'};
+
+	hashString(opt);
+	hashString(arg ? arg : "");
+}
+
+void cache_DisableStore(char const *reason) {
+	if (!storeDisabledReason)
+		storeDisabledReason = reason;
+}
+
+void cache_RecordFile(std::string const &path, std::optional<std::string> const &fullPath) {
+	if (cacheDir.empty() || !cachedFileNames.insert(path).second)
+		return;
+	cachedFiles.push_back({.name = path, .fullPath = fullPath});
+	if (fullPath && !isHashable(*fullPath))
+		cache_DisableStore("a file that was used is not a regular file");
+}
+
+bool cache_Replay(std::string const &mainPath) {
+	if (cacheDir.empty())
+		return false;
+
+	// Standard input cannot be hashed without consuming it, and without an object file,
+	// there is nothing to cache
+	if (mainPath == "-" || !isHashable(mainPath) || objectName.empty()) {
+		cacheDir.clear();
+		return false;
+	}
+
+	std::optional<ContentSpan> content = lexer_ReadFile(mainPath, SIZE_MAX);
+	if (!content) {
+		cacheDir.clear(); // Let assembly report the error
+		return false;
+	}
+
+	hashString(get_package_version_string());
+	hashString(mainPath.c_str());
+	keyHash = hashBytes(keyHash, content->ptr.get(), content->size);
+
+	char keyName[17];
+	snprintf(keyName, sizeof(keyName), "%016" PRIx64, keyHash);
+	entryPath = cacheDir + keyName + ".rgbc";
+
+	// Do not use `lexer_ReadFile`, which would keep the entry mapped until exiting
+	FILE *file = fopen(entryPath.c_str(), "rb");
+	if (!file) {
+		if (verbose)
+			printf("Cache miss for %s (no entry %s)\n", mainPath.c_str(), entryPath.c_str());
+		return false;
+	}
+	std::vector<char> entry;
+	char buf[BUFSIZ];
+	for (size_t nbRead; (nbRead = fread(buf, 1, sizeof(buf), file)) != 0;)
+		entry.insert(entry.end(), buf, buf + nbRead);
+	fclose(file);
+
+	if (entry.size() < 4 || memcmp(entry.data(), "RGBC", 4)) {
+		if (verbose)
+			printf("Cache miss for %s (invalid entry %s)\n", mainPath.c_str(), entryPath.c_str());
+		return false;
+	}
+
+	EntryReader reader{.ptr = entry.data() + 4, .end = entry.data() + entry.size()};
+	bool isValid = true;
+	uint64_t objectHash = reader.getlong(8);
+	uint32_t nbFiles = reader.getlong(4);
+	std::vector<CachedFile> files;
+
+	while (isValid && reader.ok && files.size() < nbFiles) {
+		CachedFile &cachedFile = files.emplace_back();
+
+		cachedFile.name = reader.getstring();
+		if (reader.getlong(1))
+			cachedFile.fullPath = reader.getstring();
+		uint64_t hash = cachedFile.fullPath ? reader.getlong(8) : 0;
+
+		// The file must still resolve the same way, to the same contents
+		if (fstk_ResolveFile(cachedFile.name) != cachedFile.fullPath) {
+			isValid = false;
+		} else if (cachedFile.fullPath && !isHashable(*cachedFile.fullPath)) {
+			isValid = false;
+		} else if (cachedFile.fullPath) {
+			std::optional<ContentSpan> span = lexer_ReadFile(*cachedFile.fullPath, SIZE_MAX);
+			isValid = span && hashBytes(keyHash, span->ptr.get(), span->size) == hash;
+		}
+	}
+	if (isValid && reader.ok
+	    && hashBytes(keyHash, reader.ptr, reader.end - reader.ptr) != objectHash)
+		isValid = false;
+
+	if (!isValid || !reader.ok) {
+		if (verbose)
+			printf("Cache miss for %s (stale entry %s)\n", mainPath.c_str(), entryPath.c_str());
+		return false;
+	}
+
+	if (verbose)
+		printf("Cache hit for %s (entry %s)\n", mainPath.c_str(), entryPath.c_str());
+
+	// Report dependencies as if the files had been looked up during assembly
+	for (CachedFile const &cachedFile : files)
+		fstk_FindFile(cachedFile.name);
+	out_WriteObjectData(std::vector<uint8_t>(reader.ptr, reader.end));
+	return true;
+}
+
+void cache_Store(std::vector<uint8_t> const &object) {
+	if (cacheDir.empty())
+		return;
+
+	// A cache hit would reuse the object file, but could not reproduce how it was assembled
+	if (storeDisabledReason) {
+		if (verbose)
+			printf("Not caching: %s\n", storeDisabledReason);
+		return;
+	}
+
+	std::vector<uint8_t> entry;
+	entry.reserve(object.size() + 256);
+	entry.insert(entry.end(), {'R', 'G', 'B', 'C'});
+	putlong(hashBytes(keyHash, (char const *)object.data(), object.size()), 8, entry);
+	putlong(cachedFiles.size(), 4, entry);
+
+	for (CachedFile const &cachedFile : cachedFiles) {
+		putstring(cachedFile.name, entry);
+		entry.push_back(cachedFile.fullPath.has_value());
+		if (!cachedFile.fullPath)
+			continue;
+
+		// The lexer keeps files mapped, so these are usually the very contents that were assembled
+		std::optional<ContentSpan> span = lexer_ReadFile(*cachedFile.fullPath, SIZE_MAX);
+		if (!span)
+			return;
+		putstring(*cachedFile.fullPath, entry);
+		putlong(hashBytes(keyHash, span->ptr.get(), span->size), 8, entry);
+	}
+
+	entry.insert(entry.end(), RANGE(object));
+
+	// Replace the entry atomically, so that concurrent runs never read a partial one
+	std::string tmpPath = entryPath + ".tmp";
+	FILE *file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		warn("Failed to store cache entry '%s'", tmpPath.c_str());
+		return;
+	}
+	bool written = fwrite(entry.data(), 1, entry.size(), file) == entry.size();
+	if (fclose(file) != 0 || !written) {
+		warn("Failed to store cache entry '%s'", tmpPath.c_str());
+		remove(tmpPath.c_str());
+		return;
+	}
+#ifdef _WIN32
+	remove(entryPath.c_str()); // Windows' `rename` does not replace existing files
+#endif
+	if (rename(tmpPath.c_str(), entryPath.c_str()) != 0) {
+		warn("Failed to store cache entry '%s'", entryPath.c_str());
+		remove(tmpPath.c_str());
+	} else if (verbose) {
+		printf("Stored cache entry %s\n", entryPath.c_str());
+	}
+}
@@ -2,12 +2,15 @@
 
 #include "asm/charmap.hpp"
 
+#include <algorithm>
+#include <memory>
 #include <stack>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unordered_map>
 
+#include "helpers.hpp"
 #include "util.hpp"
 
 #include "asm/warning.hpp"
@@ -15,18 +18,45 @@
 // Charmaps are stored using a structure known as "trie".
 // Essentially a tree, where each nodes stores a single character's worth of info:
 // whether there exists a mapping that ends at the current character,
+struct CharmapEdge {
+	uint8_t c;
+	// This MUST be indexes and not pointers, because pointers get invalidated by reallocation!
+	uint32_t nodeIdx;
+};
+
 struct CharmapNode {
 	bool isTerminal; // Whether there exists a mapping that ends here
 	uint8_t value;   // If the above is true, its corresponding value
-	// This MUST be indexes and not pointers, because pointers get invalidated by reallocation!
-	size_t next[255]; // Indexes of where to go next, 0 = nowhere
+	// Where to go next, sorted by char; most nodes only have a few of those
+	std::vector<CharmapEdge> next;
 };
 
 struct Charmap {
 	std::string name;
-	std::vector<CharmapNode> nodes; // first node is reserved for the root node
+	// First node is reserved for the root node.
+	// Nodes are shared with the base charmap (or charmaps based on this one) until modified.
+	std::shared_ptr<std::vector<CharmapNode>> nodes;
+	// Where to go next from the root node, 0 = nowhere.
+	// Every conversion starts there, so these are kept in a table instead of the root node.
+	uint32_t rootNext[256];
+	// Whether any mapping is longer than one char; if not, `byteValues` can convert on its own
+	bool hasMultiCharMappings;
+	// Values of single-char mappings, for chars with a non-zero `rootNext`
+	uint8_t byteValues[256];
 };
 
+// Returns the index of where to go next from a node with a char, 0 = nowhere
+static uint32_t getNext(Charmap const &charmap, uint32_t nodeIdx, uint8_t c) {
+	if (nodeIdx == 0)
+		return charmap.rootNext[c];
+
+	std::vector<CharmapEdge> const &next = (*charmap.nodes)[nodeIdx].next;
+	auto edge = std::lower_bound(RANGE(next), c, [](CharmapEdge const &e, uint8_t ch) {
+		return e.c < ch;
+	});
+	return edge != next.end() && edge->c == c ? edge->nodeIdx : 0;
+}
+
 static std::unordered_map<std::string, Charmap> charmaps;
 
 static Charmap *currentCharmap;
@@ -52,10 +82,17 @@ void charmap_New(std::string const &name, std::string const *baseName) {
 	// Init the new charmap's fields
 	Charmap &charmap = charmaps[name];
 
-	if (base)
-		charmap.nodes = base->nodes; // Copies `base->nodes`
-	else
-		charmap.nodes.emplace_back(); // Zero-init the root node
+	if (base) {
+		charmap.nodes = base->nodes; // Shares `base->nodes`
+		std::copy(RANGE(base->rootNext), charmap.rootNext);
+		charmap.hasMultiCharMappings = base->hasMultiCharMappings;
+		std::copy(RANGE(base->byteValues), charmap.byteValues);
+	} else {
+		charmap.nodes = std::make_shared<std::vector<CharmapNode>>(1); // Zero-init the root node
+		std::fill(RANGE(charmap.rootNext), 0);
+		charmap.hasMultiCharMappings = false;
+		std::fill(RANGE(charmap.byteValues), 0);
+	}
 	charmap.name = name;
 
 	currentCharmap = &charmap;
@@ -86,51 +123,85 @@ void charmap_Pop() {
 
 void charmap_Add(std::string const &mapping, uint8_t value) {
 	Charmap &charmap = *currentCharmap;
-	size_t nodeIdx = 0;
+
+	// Stop sharing nodes with other charmaps before modifying them
+	if (charmap.nodes.use_count() > 1)
+		charmap.nodes = std::make_shared<std::vector<CharmapNode>>(*charmap.nodes);
+	std::vector<CharmapNode> &nodes = *charmap.nodes;
+
+	uint32_t nodeIdx = 0;
 
 	for (char c : mapping) {
-		size_t &nextIdxRef = charmap.nodes[nodeIdx].next[(uint8_t)c - 1];
-		size_t nextIdx = nextIdxRef;
+		uint32_t nextIdx = getNext(charmap, nodeIdx, c);
 
 		if (!nextIdx) {
 			// Switch to and zero-init the new node
-			nextIdxRef = charmap.nodes.size();
-			nextIdx = nextIdxRef;
-			// This may reallocate `charmap.nodes` and invalidate `nextIdxRef`,
-			// which is why we keep the actual value in `nextIdx`
-			charmap.nodes.emplace_back();
+			nextIdx = nodes.size();
+			if (nodeIdx == 0) {
+				charmap.rootNext[(uint8_t)c] = nextIdx;
+			} else {
+				std::vector<CharmapEdge> &next = nodes[nodeIdx].next;
+				auto edge = std::find_if(RANGE(next), [&c](CharmapEdge const &e) {
+					return e.c > (uint8_t)c;
+				});
+				next.insert(edge, {.c = (uint8_t)c, .nodeIdx = nextIdx});
+			}
+			// This may reallocate `nodes`, which is why we keep indexes instead of references
+			nodes.emplace_back();
 		}
 
 		nodeIdx = nextIdx;
 	}
 
-	CharmapNode &node = charmap.nodes[nodeIdx];
+	CharmapNode &node = nodes[nodeIdx];
 
 	if (node.isTerminal)
 		warning(WARNING_CHARMAP_REDEF, "Overriding charmap mapping\n");
 
 	node.isTerminal = true;
 	node.value = value;
+
+	if (mapping.length() == 1)
+		charmap.byteValues[(uint8_t)mapping[0]] = value;
+	else if (mapping.length() > 1)
+		charmap.hasMultiCharMappings = true;
 }
 
 bool charmap_HasChar(std::string const &input) {
 	Charmap const &charmap = *currentCharmap;
-	size_t nodeIdx = 0;
+	uint32_t nodeIdx = 0;
 
 	for (char c : input) {
-		nodeIdx = charmap.nodes[nodeIdx].next[(uint8_t)c - 1];
+		nodeIdx = getNext(charmap, nodeIdx, c);
 
 		if (!nodeIdx)
 			return false;
 	}
 
-	return charmap.nodes[nodeIdx].isTerminal;
+	return (*charmap.nodes)[nodeIdx].isTerminal;
 }
 
 void charmap_Convert(std::string const &input, std::vector<uint8_t> &output) {
+	Charmap const &charmap = *currentCharmap;
 	char const *ptr = input.c_str();
-	while (charmap_ConvertNext(ptr, &output))
-		;
+
+	if (charmap.hasMultiCharMappings) {
+		while (charmap_ConvertNext(ptr, &output))
+			;
+		return;
+	}
+
+	// Every mapping is a single char, so mapped chars can be translated directly,
+	// leaving only the unmapped ones to `charmap_ConvertNext`
+	output.reserve(output.size() + input.length());
+	while (*ptr) {
+		if (uint8_t c = *ptr; charmap.rootNext[c]) {
+			output.push_back(charmap.byteValues[c]);
+			ptr++;
+		} else {
+			charmap_ConvertNext(ptr, &output);
+		}
+	}
 }
 
 size_t charmap_ConvertNext(char const *&input, std::vector<uint8_t> *output) {
@@ -139,18 +210,28 @@ size_t charmap_ConvertNext(char const *&input, std::vector<uint8_t> *output) {
 	// If that would lead to a dead end, rewind characters until the last match, and output.
 	// If no match, read a UTF-8 codepoint and output that.
 	Charmap const &charmap = *currentCharmap;
-	size_t matchIdx = 0;
+
+	// If every mapping is a single char, the first char alone decides whether there is a match
+	if (uint8_t c = *input; c && !charmap.hasMultiCharMappings && charmap.rootNext[c]) {
+		if (output)
+			output->push_back(charmap.byteValues[c]);
+		input++;
+		return 1;
+	}
+
+	std::vector<CharmapNode> const &nodes = *charmap.nodes;
+	uint32_t matchIdx = 0;
 	size_t rewindDistance = 0;
 
-	for (size_t nodeIdx = 0; *input;) {
-		nodeIdx = charmap.nodes[nodeIdx].next[(uint8_t)*input - 1];
+	for (uint32_t nodeIdx = 0; *input;) {
+		nodeIdx = getNext(charmap, nodeIdx, *input);
 
 		if (!nodeIdx)
 			break;
 
 		input++; // Consume that char
 
-		if (charmap.nodes[nodeIdx].isTerminal) {
+		if (nodes[nodeIdx].isTerminal) {
 			matchIdx = nodeIdx; // This node matches, register it
 			rewindDistance = 0; // If no longer match is found, rewind here
 		} else {
@@ -164,7 +245,7 @@ size_t charmap_ConvertNext(char const *&input, std::vector<uint8_t> *output) {
 
 	if (matchIdx) { // A match was found, use it
 		if (output)
-			output->push_back(charmap.nodes[matchIdx].value);
+			output->push_back(nodes[matchIdx].value);
 
 		return 1;
 
@@ -180,7 +261,7 @@ size_t charmap_ConvertNext(char const *&input, std::vector<uint8_t> *output) {
 		input += codepointLen;
 
 		// Warn if this character is not mapped but any others are
-		if (charmap.nodes.size() > 1)
+		if (nodes.size() > 1)
 			warning(WARNING_UNMAPPED_CHAR_1, "Unmapped character %s\n", printChar(firstChar));
 		else if (charmap.name != DEFAULT_CHARMAP_NAME)
 			warning(
@@ -6,15 +6,16 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <memory>
-#include <stack>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unordered_map>
 
 #include "error.hpp"
 #include "helpers.hpp"
 #include "linkdefs.hpp"
 #include "platform.hpp" // S_ISDIR (stat macro)
 
+#include "asm/cache.hpp"
 #include "asm/lexer.hpp"
 #include "asm/macro.hpp"
 #include "asm/main.hpp"
@@ -40,14 +41,64 @@ struct Context {
 	std::string forName{};
 };
 
-static std::stack<Context> contextStack;
+// Contexts are recycled instead of destroyed when popped, so that pushing one (e.g. for each
+// invocation of a macro in a loop) can reuse the allocations of an earlier one.
+struct ContextStack {
+	std::vector<std::unique_ptr<Context>> contexts; // The ones past `depth` are free
+	size_t depth = 0;
+
+	bool empty() const { return depth == 0; }
+	size_t size() const { return depth; }
+	Context &top() { return *contexts[depth - 1]; }
+
+	Context &push(
+	    std::shared_ptr<FileStackNode> fileInfo,
+	    std::shared_ptr<std::string> uniqueIDStr,
+	    std::shared_ptr<MacroArgs> macroArgs
+	) {
+		if (depth == contexts.size())
+			contexts.push_back(std::make_unique<Context>());
+		Context &context = *contexts[depth++];
+
+		// The lexer state is reset by setting its contents
+		context.fileInfo = fileInfo;
+		context.uniqueIDStr = uniqueIDStr;
+		context.macroArgs = macroArgs;
+		context.nbReptIters = 0;
+		context.isForLoop = false;
+		context.forValue = 0;
+		context.forStep = 0;
+		context.forName.clear();
+		return context;
+	}
+
+	void pop() {
+		Context &context = top();
+		depth--;
+
+		// Do not keep anything alive on behalf of a popped context
+		context.fileInfo = nullptr;
+		context.uniqueIDStr = nullptr;
+		context.macroArgs = nullptr;
+		context.lexerState.content.emplace<std::monostate>();
+		context.lexerState.expansions.clear();
+	}
+};
+
+static ContextStack contextStack;
 size_t maxRecursionDepth;
 
 // The first include path for `fstk_FindFile` to try is none at all
 static std::vector<std::string> includePaths = {""};
 
+// Results of `fstk_FindFile`, valid as long as the include paths do not change
+static std::unordered_map<std::string, std::optional<std::string>> foundFiles;
+
 static std::string preIncludeName;
 
+// Files found to be wrapped in an `IF !DEF(name)` ... `ENDC` include guard, and their guard names
+static std::unordered_map<std::string, std::string> includeGuards;
+
 std::vector<uint32_t> &FileStackNode::iters() {
 	assume(std::holds_alternative<std::vector<uint32_t>>(data));
 	return std::get<std::vector<uint32_t>>(data);
@@ -58,14 +109,9 @@ std::vector<uint32_t> const &FileStackNode::iters() const {
 	return std::get<std::vector<uint32_t>>(data);
 }
 
-std::string &FileStackNode::name() {
-	assume(std::holds_alternative<std::string>(data));
-	return std::get<std::string>(data);
-}
-
 std::string const &FileStackNode::name() const {
-	assume(std::holds_alternative<std::string>(data));
-	return std::get<std::string>(data);
+	assume(std::holds_alternative<std::shared_ptr<std::string const>>(data));
+	return *std::get<std::shared_ptr<std::string const>>(data);
 }
 
 std::string const &FileStackNode::dump(uint32_t curLineNo) const {
@@ -129,6 +175,8 @@ void fstk_AddIncludePath(std::string const &path) {
 	std::string &includePath = includePaths.emplace_back(path);
 	if (includePath.back() != '/')
 		includePath += '/';
+
+	foundFiles.clear();
 }
 
 void fstk_SetPreIncludeFile(std::string const &path) {
@@ -152,12 +200,28 @@ static bool isValidFilePath(std::string const &path) {
 	return stat(path.c_str(), &statBuf) == 0 && !S_ISDIR(statBuf.st_mode); // Reject directories
 }
 
-std::optional<std::string> fstk_FindFile(std::string const &path) {
+static std::optional<std::string> findFile(std::string const &path) {
 	for (std::string &incPath : includePaths) {
-		if (std::string fullPath = incPath + path; isValidFilePath(fullPath)) {
-			printDep(fullPath);
+		if (std::string fullPath = incPath + path; isValidFilePath(fullPath))
 			return fullPath;
-		}
+	}
+	return std::nullopt;
+}
+
+std::optional<std::string> const &fstk_ResolveFile(std::string const &path) {
+	auto search = foundFiles.find(path);
+	if (search == foundFiles.end())
+		search = foundFiles.emplace(path, findFile(path)).first;
+	return search->second;
+}
+
+std::optional<std::string> fstk_FindFile(std::string const &path) {
+	std::optional<std::string> const &fullPath = fstk_ResolveFile(path);
+
+	cache_RecordFile(path, fullPath);
+	if (fullPath) {
+		printDep(*fullPath);
+		return fullPath;
 	}
 
 	errno = ENOENT;
@@ -179,8 +243,9 @@ bool yywrap() {
 	if (Context &context = contextStack.top(); context.fileInfo->type == NODE_REPT) {
 		// The context is a REPT or FOR block, which may loop
 
-		// If the node is referenced outside this context, we can't edit it, so duplicate it
-		if (context.fileInfo.use_count() > 1) {
+		// If the node is referenced outside this context, or its ID was already taken (possibly
+		// shared with an identical node), we can't edit it, so duplicate it
+		if (context.fileInfo.use_count() > 1 || context.fileInfo->ID != (uint32_t)-1) {
 			context.fileInfo = std::make_shared<FileStackNode>(*context.fileInfo);
 			context.fileInfo->ID = -1; // The copy is not yet registered
 		}
@@ -208,6 +273,8 @@ bool yywrap() {
 		}
 	} else if (contextStack.size() == 1) {
 		return true;
+	} else if (LexerState const &state = context.lexerState; state.guardState == GUARD_COMPLETE) {
+		includeGuards[state.path] = state.guardName;
 	}
 
 	contextStack.pop();
@@ -227,8 +294,9 @@ static bool newFileContext(std::string const &filePath, bool updateStateNow) {
 	std::shared_ptr<std::string> uniqueIDStr = nullptr;
 	std::shared_ptr<MacroArgs> macroArgs = nullptr;
 
-	auto fileInfo =
-	    std::make_shared<FileStackNode>(NODE_MACRO, filePath == "-" ? "<stdin>" : filePath);
+	auto fileInfo = std::make_shared<FileStackNode>(
+	    NODE_MACRO, std::make_shared<std::string const>(filePath == "-" ? "<stdin>" : filePath)
+	);
 	if (!contextStack.empty()) {
 		Context &oldContext = contextStack.top();
 		fileInfo->parent = oldContext.fileInfo;
@@ -237,49 +305,55 @@ static bool newFileContext(std::string const &filePath, bool updateStateNow) {
 		macroArgs = oldContext.macroArgs;
 	}
 
-	Context &context = contextStack.emplace(Context{
-	    .fileInfo = fileInfo,
-	    .uniqueIDStr = uniqueIDStr,
-	    .macroArgs = macroArgs,
-	});
+	Context &context = contextStack.push(fileInfo, uniqueIDStr, macroArgs);
 
 	return context.lexerState.setFileAsNextState(filePath, updateStateNow);
 }
 
-static void newMacroContext(Symbol const &macro, std::shared_ptr<MacroArgs> macroArgs) {
-	checkRecursionDepth();
+// The name only depends on where the macro was defined, so it is computed once per macro
+static std::shared_ptr<std::string const> const &getMacroContextName(Symbol &macro) {
+	std::shared_ptr<std::string const> &cachedName = macro.getMacro().contextName;
+	if (cachedName)
+		return cachedName;
 
-	Context &oldContext = contextStack.top();
+	std::string contextName;
 
-	std::string fileInfoName;
 	for (FileStackNode const *node = macro.src.get(); node; node = node->parent.get()) {
 		if (node->type != NODE_REPT) {
-			fileInfoName.append(node->name());
+			contextName.append(node->name());
 			break;
 		}
 	}
 	if (macro.src->type == NODE_REPT) {
 		std::vector<uint32_t> const &srcIters = macro.src->iters();
 		for (uint32_t i = srcIters.size(); i--;) {
-			fileInfoName.append("::REPT~");
-			fileInfoName.append(std::to_string(srcIters[i]));
+			contextName.append("::REPT~");
+			contextName.append(std::to_string(srcIters[i]));
 		}
 	}
-	fileInfoName.append("::");
-	fileInfoName.append(macro.name);
+	contextName.append("::");
+	contextName.append(macro.name);
+	cachedName = std::make_shared<std::string const>(std::move(contextName));
+	return cachedName;
+}
 
-	auto fileInfo = std::make_shared<FileStackNode>(NODE_MACRO, fileInfoName);
+static void newMacroContext(Symbol &macro, std::shared_ptr<MacroArgs> macroArgs) {
+	checkRecursionDepth();
+
+	Context &oldContext = contextStack.top();
+
+	auto fileInfo = std::make_shared<FileStackNode>(NODE_MACRO, getMacroContextName(macro));
 	assume(!contextStack.empty()); // The top level context cannot be a MACRO
 	fileInfo->parent = oldContext.fileInfo;
 	fileInfo->lineNo = lexer_GetLineNo();
 
-	Context &context = contextStack.emplace(Context{
-	    .fileInfo = fileInfo,
-	    .uniqueIDStr = std::make_shared<std::string>(), // Create a new, not-yet-generated ID
-	    .macroArgs = macroArgs,
-	});
+	Context &context = contextStack.push(
+	    fileInfo,
+	    std::make_shared<std::string>(), // Create a new, not-yet-generated ID
+	    macroArgs
+	);
 
-	context.lexerState.setViewAsNextState("MACRO", macro.getMacro(), macro.fileLine);
+	context.lexerState.setViewAsNextState("MACRO", macro.getMacro().span, macro.fileLine);
 }
 
 static Context &newReptContext(int32_t reptLineNo, ContentSpan const &span, uint32_t count) {
@@ -298,11 +372,11 @@ static Context &newReptContext(int32_t reptLineNo, ContentSpan const &span, uint
 	fileInfo->parent = oldContext.fileInfo;
 	fileInfo->lineNo = reptLineNo;
 
-	Context &context = contextStack.emplace(Context{
-	    .fileInfo = fileInfo,
-	    .uniqueIDStr = std::make_shared<std::string>(), // Create a new, not-yet-generated ID
-	    .macroArgs = oldContext.macroArgs,
-	});
+	Context &context = contextStack.push(
+	    fileInfo,
+	    std::make_shared<std::string>(), // Create a new, not-yet-generated ID
+	    oldContext.macroArgs
+	);
 
 	context.lexerState.setViewAsNextState("REPT", span, reptLineNo);
 
@@ -325,6 +399,18 @@ void fstk_RunInclude(std::string const &path, bool preInclude) {
 		return;
 	}
 
+	// Including a file whose include guard is defined would do nothing but skip it
+	if (auto search = includeGuards.find(*fullPath); search != includeGuards.end()
+	    && sym_FindScopedValidSymbol(search->second)) {
+		if (verbose)
+			printf(
+			    "Skipping INCLUDE file \"%s\" (guarded by \"%s\")\n",
+			    fullPath->c_str(),
+			    search->second.c_str()
+			);
+		return;
+	}
+
 	if (!newFileContext(*fullPath, false))
 		fatalerror("Failed to set up lexer for file include\n");
 }
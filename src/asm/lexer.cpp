@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string_view>
 #include <unordered_map>
 #ifndef _MSC_VER
 	#include <unistd.h>
@@ -27,6 +28,7 @@
 #include "asm/fstack.hpp"
 #include "asm/macro.hpp"
 #include "asm/main.hpp"
+#include "asm/rope.hpp"
 #include "asm/rpn.hpp"
 #include "asm/symbol.hpp"
 #include "asm/warning.hpp"
@@ -106,31 +108,19 @@ using namespace std::literals;
 
 struct Token {
 	int type;
-	std::variant<std::monostate, uint32_t, std::string> value;
+	std::variant<std::monostate, uint32_t, std::string, Rope> value;
 
 	Token() : type(T_(NUMBER)), value(std::monostate{}) {}
 	Token(int type_) : type(type_), value(std::monostate{}) {}
 	Token(int type_, uint32_t value_) : type(type_), value(value_) {}
 	Token(int type_, std::string const &value_) : type(type_), value(value_) {}
-	Token(int type_, std::string &&value_) : type(type_), value(value_) {}
+	Token(int type_, std::string &&value_) : type(type_), value(std::move(value_)) {}
+	Token(int type_, Rope &&value_) : type(type_), value(std::move(value_)) {}
 };
 
-struct CaseInsensitive {
-	// FNV-1a hash of an uppercased string
-	size_t operator()(std::string const &str) const {
-		size_t hash = 0x811C9DC5;
-
-		for (char const &c : str)
-			hash = (hash ^ toupper(c)) * 16777619;
-		return hash;
-	}
-
-	// Compare two strings without case-sensitivity (by converting to uppercase)
-	bool operator()(std::string const &str1, std::string const &str2) const {
-		return std::equal(RANGE(str1), RANGE(str2), [](char c1, char c2) {
-			return toupper(c1) == toupper(c2);
-		});
-	}
+struct Keyword {
+	std::string_view name; // Uppercase, so that it can be compared against `toUpper`ed chars
+	int type;
 };
 
 // Identifiers that are also keywords are listed here. This ONLY applies to ones
@@ -138,7 +128,7 @@ struct CaseInsensitive {
 // see how this is used.
 // Tokens / keywords not handled here are handled in `yylex_NORMAL`'s switch.
 // This assumes that no two keywords have the same name.
-static std::unordered_map<std::string, int, CaseInsensitive, CaseInsensitive> keywordDict = {
+static constexpr Keyword keywords[] = {
     {"ADC",           T_(Z80_ADC)          },
     {"ADD",           T_(Z80_ADD)          },
     {"AND",           T_(Z80_AND)          },
@@ -328,6 +318,67 @@ static std::unordered_map<std::string, int, CaseInsensitive, CaseInsensitive> ke
     {".",             T_(PERIOD)           },
 };
 
+// Keywords are looked up in a perfect hash table, built at compile time with a hash seed for which
+// no two keywords share a slot. Thus, checking whether an identifier is a keyword costs one hash
+// and at most one comparison, with no allocation.
+
+static constexpr char toUpper(char c) {
+	return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+}
+
+// FNV-1a hash of an uppercased string, seeded via the offset basis
+static constexpr uint32_t hashKeyword(std::string_view str, uint32_t seed) {
+	uint32_t hash = seed;
+
+	for (char c : str)
+		hash = (hash ^ (uint8_t)toUpper(c)) * 16777619;
+	return hash ^ hash >> 16; // Fold the better-mixed high bits into the slot index
+}
+
+struct KeywordTable {
+	static constexpr size_t size = 4096; // Sparse enough for a seed to be found quickly
+	static_assert(std::size(keywords) < UINT8_MAX, "Too many keywords for the table's slots");
+
+	// The first seed without collisions, counting up from the FNV-1a offset basis (0x811C9DC5).
+	// Searching for it at compile time would exceed some compilers' constexpr evaluation limits.
+	static constexpr uint32_t seed = 0x811C9DF9;
+
+	size_t maxLength; // Longer identifiers need not even be hashed
+	bool collided;
+	uint8_t slots[size]; // 1 + index into `keywords` for occupied slots, 0 for empty ones
+};
+
+static constexpr KeywordTable keywordTable = [] {
+	KeywordTable table{};
+
+	for (size_t i = 0; i < std::size(keywords); i++) {
+		table.maxLength = std::max(table.maxLength, keywords[i].name.length());
+
+		uint8_t &slot = table.slots[hashKeyword(keywords[i].name, table.seed) % table.size];
+		table.collided |= slot != 0;
+		slot = i + 1;
+	}
+	return table;
+}();
+static_assert(!keywordTable.collided, "Keywords collide, so `KeywordTable::seed` must be updated");
+
+static Keyword const *findKeyword(std::string_view name) {
+	if (name.length() > keywordTable.maxLength)
+		return nullptr;
+
+	uint8_t slot = keywordTable.slots[hashKeyword(name, keywordTable.seed) % keywordTable.size];
+	if (slot == 0)
+		return nullptr;
+
+	Keyword const &keyword = keywords[slot - 1];
+	if (name.length() != keyword.name.length()
+	    || !std::equal(RANGE(name), keyword.name.begin(), [](char c1, char c2) {
+		       return toUpper(c1) == c2;
+	       }))
+		return nullptr;
+	return &keyword;
+}
+
 static bool isWhitespace(int c) {
 	return c == ' ' || c == '\t';
 }
@@ -335,6 +386,14 @@ static bool isWhitespace(int c) {
 static LexerState *lexerState = nullptr;
 static LexerState *lexerStateEOL = nullptr;
 
+// Files stay mapped until the end of assembly, so `INCLUDE`ing or `INCBIN`ing them again does not
+// remap them
+static std::unordered_map<std::string, ContentSpan> mappedFiles;
+
+// Number of heap-allocated token strings (including ropes) passed to the parser, which are moved
+// instead of copied; this counts all tokens lexed so far, from every file
+static uint64_t nbMovedStrings = 0;
+
 void LexerState::clear(uint32_t lineNo_) {
 	mode = LEXER_NORMAL;
 	atLineStart = true; // yylex() will init colNo due to this
@@ -343,6 +402,7 @@ void LexerState::clear(uint32_t lineNo_) {
 	ifStack.clear();
 
 	capturing = false;
+	captureSlice = {.ptr = nullptr, .size = 0};
 	captureBuf = nullptr;
 
 	disableMacroArgs = false;
@@ -352,6 +412,8 @@ void LexerState::clear(uint32_t lineNo_) {
 
 	expansions.clear();
 
+	guardState = GUARD_NONE;
+
 	lineNo = lineNo_; // Will be incremented at next line start
 }
 
@@ -373,6 +435,10 @@ void lexer_DecIFDepth() {
 		fatalerror("Found ENDC outside an IF construct\n");
 
 	lexerState->ifStack.pop_front();
+
+	// Leaving the outermost `IF` of an include guard ends it
+	if (lexerState->guardState == GUARD_OPEN && lexerState->ifStack.empty())
+		lexerState->guardState = GUARD_CLOSED;
 }
 
 bool lexer_RanIFBlock() {
@@ -395,12 +461,95 @@ void LexerState::setAsCurrentState() {
 	lexerState = this;
 }
 
+// Reads the contents of a file that could not be mapped, so that they can be viewed as if they
+// had been; reading stops after `maxSize` bytes, since e.g. devices or FIFOs may never end.
+// Returns nothing on failure, with `errno` set
+static std::optional<ContentSpan> readFile(int fd, size_t maxSize) {
+	auto buf = std::make_shared<std::vector<char>>(std::min((size_t)LEXER_READ_SIZE, maxSize));
+	size_t size = 0;
+
+	while (size < maxSize) {
+		// Double the buffer whenever it gets full, so that large files need few reads
+		if (size == buf->size())
+			buf->resize(std::min(size * 2, maxSize));
+
+		size_t nbChars = std::min(buf->size() - size, (size_t)SSIZE_MAX);
+		ssize_t nbReadChars = read(fd, &(*buf)[size], nbChars);
+
+		if (nbReadChars == -1)
+			return std::nullopt;
+		if (nbReadChars == 0)
+			break;
+		// `nbReadChars` cannot be negative, so it's fine to cast to `size_t`
+		size += (size_t)nbReadChars;
+	}
+
+	return ContentSpan{.ptr = std::shared_ptr<char[]>(buf, buf->data()), .size = size};
+}
+
+// Maps the whole contents of an opened file, or reads up to `maxSize` bytes of them if that fails
+// (e.g. for pipes); returns nothing on failure, with `errno` set
+static std::optional<ContentSpan>
+    loadFile(int fd, std::string const &path, off_t size, size_t maxSize) {
+	if (size > 0) {
+		// Try using `mmap` for better performance
+		if (char *mappingAddr = mapFile(fd, path, size); mappingAddr != nullptr) {
+			ContentSpan span{
+			    .ptr = std::shared_ptr<char[]>(mappingAddr, FileUnmapDeleter(size)),
+			    .size = (size_t)size,
+			};
+			mappedFiles.emplace(path, span);
+			if (verbose)
+				printf("File \"%s\" is mmap()ped\n", path.c_str());
+			return span;
+		}
+	}
+
+	// Sometimes mmap() fails or isn't available, so have a fallback
+	if (verbose) {
+		if (size == 0)
+			printf("File \"%s\" is empty\n", path.c_str());
+		else
+			printf("File \"%s\" is opened; errno reports: %s\n", path.c_str(), strerror(errno));
+	}
+	return readFile(fd, maxSize);
+}
+
+std::optional<ContentSpan> lexer_ReadFile(std::string const &path, size_t maxSize) {
+	if (auto search = mappedFiles.find(path); search != mappedFiles.end()) {
+		if (verbose)
+			printf("File \"%s\" is already mmap()ped\n", path.c_str());
+		return search->second;
+	}
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return std::nullopt;
+	Defer closeFile{[&] { close(fd); }};
+
+	struct stat statBuf;
+	if (fstat(fd, &statBuf) != 0)
+		return std::nullopt;
+	return loadFile(fd, path, statBuf.st_size, maxSize);
+}
+
 bool LexerState::setFileAsNextState(std::string const &filePath, bool updateStateNow) {
 	if (filePath == "-") {
 		path = "<stdin>";
-		content.emplace<BufferedContent>(STDIN_FILENO);
+		std::optional<ContentSpan> span = readFile(STDIN_FILENO, SIZE_MAX);
+		if (!span) {
+			error("Error while reading \"%s\": %s\n", path.c_str(), strerror(errno));
+			return false;
+		}
+		content.emplace<ViewedContent>(*span);
 		if (verbose)
-			printf("Opening stdin\n");
+			printf("Read %zu bytes from stdin\n", span->size);
+	} else if (auto search = mappedFiles.find(filePath); search != mappedFiles.end()) {
+		// Reuse the mapping from an earlier `INCLUDE` of the same file
+		path = filePath;
+		content.emplace<ViewedContent>(search->second);
+		if (verbose)
+			printf("File \"%s\" is already mmap()ped\n", path.c_str());
 	} else {
 		struct stat statBuf;
 		if (stat(filePath.c_str(), &statBuf) != 0) {
@@ -415,37 +564,18 @@ bool LexerState::setFileAsNextState(std::string const &filePath, bool updateStat
 			return false;
 		}
 
-		bool isMmapped = false;
-
-		if (size_t size = (size_t)statBuf.st_size; statBuf.st_size > 0) {
-			// Try using `mmap` for better performance
-			if (char *mappingAddr = mapFile(fd, path, size); mappingAddr != nullptr) {
-				close(fd);
-				content.emplace<ViewedContent>(
-				    std::shared_ptr<char[]>(mappingAddr, FileUnmapDeleter(size)), size
-				);
-				if (verbose)
-					printf("File \"%s\" is mmap()ped\n", path.c_str());
-				isMmapped = true;
-			}
-		}
-
-		if (!isMmapped) {
-			// Sometimes mmap() fails or isn't available, so have a fallback
-			content.emplace<BufferedContent>(fd);
-			if (verbose) {
-				if (statBuf.st_size == 0) {
-					printf("File \"%s\" is empty\n", path.c_str());
-				} else {
-					printf(
-					    "File \"%s\" is opened; errno reports: %s\n", path.c_str(), strerror(errno)
-					);
-				}
-			}
+		std::optional<ContentSpan> span = loadFile(fd, path, statBuf.st_size, SIZE_MAX);
+		close(fd);
+		if (!span) {
+			error("Error while reading \"%s\": %s\n", path.c_str(), strerror(errno));
+			return false;
 		}
+		content.emplace<ViewedContent>(*span);
 	}
 
 	clear(0);
+	guardState = GUARD_MATCHING;
+	guardTokensMatched = 0;
 	if (updateStateNow)
 		lexerState = this;
 	else
@@ -488,57 +618,6 @@ bool Expansion::advance() {
 	return offset > size();
 }
 
-BufferedContent::~BufferedContent() {
-	close(fd);
-}
-
-void BufferedContent::advance() {
-	assume(offset < LEXER_BUF_SIZE);
-	offset++;
-	if (offset == LEXER_BUF_SIZE)
-		offset = 0; // Wrap around if necessary
-	assume(size > 0);
-	size--;
-}
-
-void BufferedContent::refill() {
-	size_t target = LEXER_BUF_SIZE - size; // Aim: making the buf full
-
-	// Compute the index we'll start writing to
-	size_t startIndex = (offset + size) % LEXER_BUF_SIZE;
-
-	// If the range to fill passes over the buffer wrapping point, we need two reads
-	if (startIndex + target > LEXER_BUF_SIZE) {
-		size_t nbExpectedChars = LEXER_BUF_SIZE - startIndex;
-		size_t nbReadChars = readMore(startIndex, nbExpectedChars);
-
-		startIndex += nbReadChars;
-		if (startIndex == LEXER_BUF_SIZE)
-			startIndex = 0;
-
-		// If the read was incomplete, don't perform a second read
-		target -= nbReadChars;
-		if (nbReadChars < nbExpectedChars)
-			target = 0;
-	}
-	if (target != 0)
-		readMore(startIndex, target);
-}
-
-size_t BufferedContent::readMore(size_t startIndex, size_t nbChars) {
-	// This buffer overflow made me lose WEEKS of my life. Never again.
-	assume(startIndex + nbChars <= LEXER_BUF_SIZE);
-	ssize_t nbReadChars = read(fd, &buf[startIndex], nbChars);
-
-	if (nbReadChars == -1)
-		fatalerror("Error while reading \"%s\": %s\n", lexerState->path.c_str(), strerror(errno));
-
-	size += nbReadChars;
-
-	// `nbReadChars` cannot be negative, so it's fine to cast to `size_t`
-	return (size_t)nbReadChars;
-}
-
 void lexer_SetMode(LexerMode mode) {
 	lexerState->mode = mode;
 }
@@ -553,6 +632,10 @@ static void beginExpansion(std::shared_ptr<std::string> str, std::optional<std::
 	if (name)
 		lexer_CheckRecursionDepth();
 
+	// An include guard's name must not depend on how the file is included
+	if (lexerState->guardState == GUARD_MATCHING)
+		lexerState->guardState = GUARD_NONE;
+
 	// Do not expand empty strings
 	if (str->empty())
 		return;
@@ -696,14 +779,6 @@ int LexerState::peekChar() {
 	if (auto *view = std::get_if<ViewedContent>(&content); view) {
 		if (view->offset < view->span.size)
 			return (uint8_t)view->span.ptr[view->offset];
-	} else {
-		assume(std::holds_alternative<BufferedContent>(content));
-		auto &cbuf = std::get<BufferedContent>(content);
-		if (cbuf.size == 0)
-			cbuf.refill();
-		assume(cbuf.offset < LEXER_BUF_SIZE);
-		if (cbuf.size > 0)
-			return (uint8_t)cbuf.buf[cbuf.offset];
 	}
 
 	// If there aren't enough chars, give up
@@ -726,14 +801,6 @@ int LexerState::peekCharAhead() {
 	if (auto *view = std::get_if<ViewedContent>(&content); view) {
 		if (view->offset + distance < view->span.size)
 			return (uint8_t)view->span.ptr[view->offset + distance];
-	} else {
-		assume(std::holds_alternative<BufferedContent>(content));
-		auto &cbuf = std::get<BufferedContent>(content);
-		assume(distance < LEXER_BUF_SIZE);
-		if (cbuf.size <= distance)
-			cbuf.refill();
-		if (cbuf.size > distance)
-			return (uint8_t)cbuf.buf[(cbuf.offset + distance) % LEXER_BUF_SIZE];
 	}
 
 	// If there aren't enough chars, give up
@@ -742,7 +809,7 @@ int LexerState::peekCharAhead() {
 
 // forward declarations for peek
 static void shiftChar();
-static std::shared_ptr<std::string> readInterpolation(size_t depth);
+static std::optional<Rope> readInterpolation(size_t depth);
 
 static int peek() {
 	int c = lexerState->peekChar();
@@ -781,7 +848,8 @@ static int peek() {
 		// If character is an open brace, do symbol interpolation
 		shiftChar();
 
-		if (auto str = readInterpolation(0); str) {
+		if (auto interpolation = readInterpolation(0); interpolation) {
+			std::shared_ptr<std::string> str = interpolation->sharedStr();
 			beginExpansion(str, *str);
 		}
 
@@ -791,8 +859,20 @@ static int peek() {
 	return c;
 }
 
+// Switches the capture to copying chars, once they no longer come from its `captureSlice`
+static void spillCapture(size_t nbNewChars) {
+	if (lexerState->captureBuf
+	    || lexerState->captureSize + nbNewChars <= lexerState->captureSlice.size)
+		return;
+
+	char const *start = lexerState->captureSlice.ptr.get();
+	lexerState->captureBuf =
+	    std::make_shared<std::vector<char>>(start, start + lexerState->captureSize);
+}
+
 static void shiftChar() {
 	if (lexerState->capturing) {
+		spillCapture(1);
 		if (lexerState->captureBuf)
 			lexerState->captureBuf->push_back(peek());
 		lexerState->captureSize++;
@@ -812,13 +892,8 @@ restart:
 	} else {
 		// Advance within the file contents
 		lexerState->colNo++;
-		if (auto *view = std::get_if<ViewedContent>(&lexerState->content); view) {
+		if (auto *view = std::get_if<ViewedContent>(&lexerState->content); view)
 			view->offset++;
-		} else {
-			assume(std::holds_alternative<BufferedContent>(lexerState->content));
-			auto &cbuf = std::get<BufferedContent>(lexerState->content);
-			cbuf.advance();
-		}
 	}
 }
 
@@ -836,6 +911,75 @@ static void handleCRLF(int c) {
 		shiftChar();
 }
 
+// Fast paths to read directly from the innermost expansion or the file view, bypassing `peek()`
+// and `shiftChar()` for each char. The chars read are exactly what `peek()` would return...
+// except for macro args and interpolations, so callers must stop at any '\\' or '{', and let
+// `peek()` handle them. Reading past the end of an expansion is also left to `peek()`.
+
+// Returns all chars from the read position onwards, without consuming them.
+// If the fast path is not possible, returns nothing, leaving it all to the per-char path.
+static std::string_view peekRest() {
+	if (!lexerState->expansions.empty()) {
+		Expansion const &exp = lexerState->expansions.front();
+		return std::string_view(*exp.contents).substr(exp.offset);
+	}
+	if (auto *view = std::get_if<ViewedContent>(&lexerState->content); view)
+		return std::string_view(&view->span.ptr[view->offset], view->span.size - view->offset);
+	return {};
+}
+
+// Returns the run of chars at the read position that satisfy `pred`, without consuming them.
+template<typename P>
+static std::string_view peekRun(P pred) {
+	std::string_view rest = peekRest();
+	auto end = std::find_if_not(RANGE(rest), [&pred](char c) { return pred((uint8_t)c); });
+	return rest.substr(0, end - rest.begin());
+}
+
+// Consumes `n` chars previously returned by `peekRun`, doing what `shiftChar()` would.
+static void shiftChars(size_t n) {
+	if (n == 0)
+		return;
+
+	char const *start = peekRest().data();
+	if (lexerState->capturing) {
+		spillCapture(n);
+		if (lexerState->captureBuf)
+			lexerState->captureBuf->insert(lexerState->captureBuf->end(), start, start + n);
+		lexerState->captureSize += n;
+	}
+	lexerState->macroArgScanDistance -= std::min(lexerState->macroArgScanDistance, n);
+	if (!lexerState->expansions.empty()) {
+		// The expansion may be left exhausted, but it will be popped by the next `shiftChar()`
+		lexerState->expansions.front().offset += n;
+	} else {
+		lexerState->colNo += n;
+		std::get<ViewedContent>(lexerState->content).offset += n;
+	}
+}
+
+// Advance up to the next char that the per-char loops must see: an end of line,
+// or a backslash if `stopAtBackslash` (which escapes the following char).
+// If the fast path is not possible, this does nothing, and the per-char loops do it all.
+static void skipToLineBreak(bool stopAtBackslash) {
+	// Expansions being disabled, backslashes and braces do not need to go through `peek()`
+	assume(lexerState->disableMacroArgs && lexerState->disableInterpolation);
+
+	std::string_view rest = peekRest();
+	if (rest.empty())
+		return;
+	// `memchr` is vectorized on all major platforms, unlike a char-by-char loop
+	if (char const *lf = (char const *)memchr(rest.data(), '\n', rest.size()); lf)
+		rest = rest.substr(0, lf - rest.data());
+	if (char const *cr = (char const *)memchr(rest.data(), '\r', rest.size()); cr)
+		rest = rest.substr(0, cr - rest.data());
+	if (stopAtBackslash) {
+		if (char const *bs = (char const *)memchr(rest.data(), '\\', rest.size()); bs)
+			rest = rest.substr(0, bs - rest.data());
+	}
+	shiftChars(rest.size());
+}
+
 static auto scopedDisableExpansions() {
 	lexerState->disableMacroArgs = true;
 	lexerState->disableInterpolation = true;
@@ -848,13 +992,18 @@ static auto scopedDisableExpansions() {
 // "Services" provided by the lexer to the rest of the program
 
 uint32_t lexer_GetLineNo() {
-	return lexerState->lineNo;
+	// Files may fail to be read before their lexer state becomes current
+	return lexerState ? lexerState->lineNo : 0;
 }
 
 uint32_t lexer_GetColNo() {
 	return lexerState->colNo;
 }
 
+uint64_t lexer_GetNbMovedStrings() {
+	return nbMovedStrings;
+}
+
 void lexer_DumpStringExpansions() {
 	if (!lexerState)
 		return;
@@ -904,6 +1053,7 @@ static void discardBlockComment() {
 
 static void discardComment() {
 	Defer reenableExpansions = scopedDisableExpansions();
+	skipToLineBreak(false);
 	for (;; shiftChar()) {
 		int c = peek();
 
@@ -936,7 +1086,7 @@ static void discardLineContinuation() {
 
 // Functions to read tokenizable values
 
-static std::string readAnonLabelRef(char c) {
+static uint32_t readAnonLabelRef(char c) {
 	uint32_t n = 0;
 
 	// We come here having already peeked at one char, so no need to do it again
@@ -945,22 +1095,32 @@ static std::string readAnonLabelRef(char c) {
 		n++;
 	} while (peek() == c);
 
-	return sym_MakeAnonLabelName(n, c == '-');
+	return sym_GetAnonLabelID(n, c == '-');
 }
 
 static uint32_t readNumber(int radix, uint32_t baseValue) {
 	uint32_t value = baseValue;
+	auto isDigit = [radix](int c) { return c >= '0' && c <= '0' + radix - 1; };
+	auto addDigit = [&](int c) {
+		if (c == '_')
+			return;
+		if (value > (UINT32_MAX - (c - '0')) / radix)
+			warning(WARNING_LARGE_CONSTANT, "Integer constant is too large\n");
+		value = value * radix + (c - '0');
+	};
+
+	// Read as many digits as possible directly
+	std::string_view digits = peekRun([&](int c) { return c == '_' || isDigit(c); });
+	for (char c : digits)
+		addDigit(c);
+	shiftChars(digits.size());
 
 	for (;; shiftChar()) {
 		int c = peek();
 
-		if (c == '_')
-			continue;
-		else if (c < '0' || c > '0' + radix - 1)
+		if (c != '_' && !isDigit(c))
 			break;
-		if (value > (UINT32_MAX - (c - '0')) / radix)
-			warning(WARNING_LARGE_CONSTANT, "Integer constant is too large\n");
-		value = value * radix + (c - '0');
+		addDigit(c);
 	}
 
 	return value;
@@ -1055,10 +1215,8 @@ static uint32_t readBinaryNumber() {
 static uint32_t readHexNumber() {
 	uint32_t value = 0;
 	bool empty = true;
-
-	for (;; shiftChar()) {
-		int c = peek();
-
+	// Returns false if `c` does not continue the number
+	auto addDigit = [&](int c) {
 		if (c >= 'a' && c <= 'f')
 			c = c - 'a' + 10;
 		else if (c >= 'A' && c <= 'F')
@@ -1066,16 +1224,27 @@ static uint32_t readHexNumber() {
 		else if (c >= '0' && c <= '9')
 			c = c - '0';
 		else if (c == '_' && !empty)
-			continue;
+			return true;
 		else
-			break;
+			return false;
 
 		if (value > (UINT32_MAX - c) / 16)
 			warning(WARNING_LARGE_CONSTANT, "Integer constant is too large\n");
 		value = value * 16 + c;
 
 		empty = false;
-	}
+		return true;
+	};
+
+	// Read as many digits as possible directly
+	std::string_view digits = peekRun([](int c) { return isxdigit(c) || c == '_'; });
+	size_t nbDigits = 0;
+	while (nbDigits < digits.size() && addDigit(digits[nbDigits]))
+		nbDigits++;
+	shiftChars(nbDigits);
+
+	for (; addDigit(peek()); shiftChar())
+		;
 
 	if (empty)
 		error("Invalid integer constant, no digits after '$'\n");
@@ -1142,6 +1311,14 @@ static Token readIdentifier(char firstChar) {
 	std::string identifier(1, firstChar);
 	int tokenType = firstChar == '.' ? T_(LOCAL_ID) : T_(ID);
 
+	// Read as much of the identifier as possible directly
+	if (std::string_view chars = peekRun(continuesIdentifier); !chars.empty()) {
+		identifier.append(chars);
+		if (chars.find('.') != chars.npos)
+			tokenType = T_(LOCAL_ID);
+		shiftChars(chars.size());
+	}
+
 	// Continue reading while the char is in the symbol charset
 	for (int c = peek(); continuesIdentifier(c); c = peek()) {
 		shiftChar();
@@ -1155,13 +1332,13 @@ static Token readIdentifier(char firstChar) {
 	}
 
 	// Attempt to check for a keyword
-	auto search = keywordDict.find(identifier.c_str());
-	return search != keywordDict.end() ? Token(search->second) : Token(tokenType, identifier);
+	Keyword const *keyword = findKeyword(identifier);
+	return keyword ? Token(keyword->type) : Token(tokenType, std::move(identifier));
 }
 
 // Functions to read strings
 
-static std::shared_ptr<std::string> readInterpolation(size_t depth) {
+static std::optional<Rope> readInterpolation(size_t depth) {
 	if (depth > maxRecursionDepth)
 		fatalerror("Recursion limit (%zu) exceeded\n", maxRecursionDepth);
 
@@ -1179,9 +1356,10 @@ static std::shared_ptr<std::string> readInterpolation(size_t depth) {
 
 		if (c == '{') { // Nested interpolation
 			shiftChar();
-			auto str = readInterpolation(depth + 1);
-
-			beginExpansion(str, *str);
+			if (auto interpolation = readInterpolation(depth + 1); interpolation) {
+				std::shared_ptr<std::string> str = interpolation->sharedStr();
+				beginExpansion(str, *str);
+			}
 			continue; // Restart, reading from the new buffer
 		} else if (c == EOF || c == '\r' || c == '\n' || c == '"') {
 			error("Missing }\n");
@@ -1211,17 +1389,20 @@ static std::shared_ptr<std::string> readInterpolation(size_t depth) {
 	if (!sym) {
 		error("Interpolated symbol \"%s\" does not exist\n", fmtBuf.c_str());
 	} else if (sym->type == SYM_EQUS) {
-		auto buf = std::make_shared<std::string>();
-		fmt.appendString(*buf, *sym->getEqus());
-		return buf;
+		// Without a format spec, the value is used as-is, so share it instead of copying it
+		if (fmt.isEmpty())
+			return sym->getEqus();
+		std::string buf;
+		fmt.appendString(buf, sym->getEqus().str());
+		return Rope(std::move(buf));
 	} else if (sym->isNumeric()) {
-		auto buf = std::make_shared<std::string>();
-		fmt.appendNumber(*buf, sym->getConstantValue());
-		return buf;
+		std::string buf;
+		fmt.appendNumber(buf, sym->getConstantValue());
+		return Rope(std::move(buf));
 	} else {
 		error("Only numerical and string symbols can be interpolated\n");
 	}
-	return nullptr;
+	return std::nullopt;
 }
 
 static void appendEscapedString(std::string &str, std::string const &escape) {
@@ -1249,7 +1430,13 @@ static void appendEscapedString(std::string &str, std::string const &escape) {
 	}
 }
 
-static std::string readString(bool raw) {
+// Characters that `readString` and `appendStringLiteral` copy as-is, whether raw or not
+static bool isRegularStringChar(int c) {
+	return c != '"' && c != '\\' && c != '{' && c != '\r' && c != '\n';
+}
+
+// Interpolated strings are shared, not copied, so that strings can be accumulated in linear time
+static Rope readString(bool raw) {
 	Defer reenableExpansions = scopedDisableExpansions();
 
 	// We reach this function after reading a single quote, but we also support triple quotes
@@ -1262,17 +1449,24 @@ static std::string readString(bool raw) {
 			multiline = true;
 		} else {
 			// "" is an empty string, skip the loop
-			return ""s;
+			return Rope();
 		}
 	}
 
+	Rope rope;
 	for (std::string str = ""s;;) {
+		// Copy runs of regular characters directly if possible
+		std::string_view chars = peekRun(isRegularStringChar);
+		str.append(chars);
+		shiftChars(chars.size());
+
 		int c = peek();
 
 		// '\r', '\n' or EOF ends a single-line string early
 		if (c == EOF || (!multiline && (c == '\r' || c == '\n'))) {
 			error("Unterminated string\n");
-			return str;
+			rope += Rope(std::move(str));
+			return rope;
 		}
 
 		// We'll be staying in the string, so we can safely consume the char
@@ -1299,7 +1493,8 @@ static std::string readString(bool raw) {
 				}
 				shiftChar();
 			}
-			return str;
+			rope += Rope(std::move(str));
+			return rope;
 
 		case '\\': // Character escape or macro arg
 			if (raw)
@@ -1372,7 +1567,9 @@ static std::string readString(bool raw) {
 			// (Not interpolations, since they're handled by the function itself...)
 			lexerState->disableMacroArgs = false;
 			if (auto interpolation = readInterpolation(0); interpolation) {
-				str.append(*interpolation);
+				rope += Rope(std::move(str));
+				rope += *interpolation;
+				str.clear();
 			}
 			lexerState->disableMacroArgs = true;
 			continue; // Do not copy an additional character
@@ -1405,6 +1602,11 @@ static void appendStringLiteral(std::string &str, bool raw) {
 	}
 
 	for (;;) {
+		// Copy runs of regular characters directly if possible
+		std::string_view chars = peekRun(isRegularStringChar);
+		str.append(chars);
+		shiftChars(chars.size());
+
 		int c = peek();
 
 		// '\r', '\n' or EOF ends a single-line string early
@@ -1505,7 +1707,7 @@ static void appendStringLiteral(std::string &str, bool raw) {
 			// (Not interpolations, since they're handled by the function itself...)
 			lexerState->disableMacroArgs = false;
 			if (auto interpolation = readInterpolation(0); interpolation) {
-				appendEscapedString(str, *interpolation);
+				appendEscapedString(str, interpolation->str());
 			}
 			lexerState->disableMacroArgs = true;
 			continue; // Do not copy an additional character
@@ -1520,6 +1722,7 @@ static void appendStringLiteral(std::string &str, bool raw) {
 // Lexer core
 
 static Token yylex_SKIP_TO_ENDC(); // forward declaration for yylex_NORMAL
+static void trackIncludeGuard(Token const &token); // forward declaration for yylex_NORMAL
 
 static Token yylex_NORMAL() {
 	for (;;) {
@@ -1533,6 +1736,8 @@ static Token yylex_NORMAL() {
 			[[fallthrough]];
 		case ' ':
 		case '\t':
+			// Skip the rest of the whitespace at once if possible
+			shiftChars(peekRun(isWhitespace).size());
 			break;
 
 			// Handle unambiguous single-char tokens
@@ -1540,10 +1745,8 @@ static Token yylex_NORMAL() {
 		case '~':
 			return Token(T_(OP_NOT));
 
-		case '@': {
-			std::string symName("@");
-			return Token(T_(ID), symName);
-		}
+		case '@':
+			return Token(T_(ID), "@"s);
 
 		case '[':
 			return Token(T_(LBRACK));
@@ -1677,10 +1880,8 @@ static Token yylex_NORMAL() {
 				shiftChar();
 				return Token(T_(DOUBLE_COLON));
 			case '+':
-			case '-': {
-				std::string symName = readAnonLabelRef(c);
-				return Token(T_(ANON), symName);
-			}
+			case '-':
+				return Token(T_(ANON), readAnonLabelRef(c));
 			default:
 				return Token(T_(COLON));
 			}
@@ -1776,8 +1977,12 @@ static Token yylex_NORMAL() {
 
 				// An ELIF after a taken IF needs to not evaluate its condition
 				if (token.type == T_(POP_ELIF) && lexerState->lastToken == T_(NEWLINE)
-				    && lexer_GetIFDepth() > 0 && lexer_RanIFBlock() && !lexer_ReachedELSEBlock())
+				    && lexer_GetIFDepth() > 0 && lexer_RanIFBlock() && !lexer_ReachedELSEBlock()) {
+					// `yylex` will never see this `ELIF`, but it may still break an include guard
+					if (lexerState->guardState != GUARD_NONE)
+						trackIncludeGuard(token);
 					return yylex_SKIP_TO_ENDC();
+				}
 
 				// If a keyword, don't try to expand
 				if (token.type != T_(ID) && token.type != T_(LOCAL_ID))
@@ -1792,10 +1997,7 @@ static Token yylex_NORMAL() {
 					Symbol const *sym = sym_FindExactSymbol(std::get<std::string>(token.value));
 
 					if (sym && sym->type == SYM_EQUS) {
-						std::shared_ptr<std::string> str = sym->getEqus();
-
-						assume(str);
-						beginExpansion(str, sym->name);
+						beginExpansion(sym->getEqus().sharedStr(), sym->name);
 						continue; // Restart, reading from the new buffer
 					}
 				}
@@ -1956,7 +2158,7 @@ finish:
 	// mode end the current macro argument but are not tokenized themselves.
 	if (c == ',') {
 		shiftChar();
-		return Token(T_(STRING), str);
+		return Token(T_(STRING), Rope(std::move(str)));
 	}
 
 	// The last argument may end in a trailing comma, newline, or EOF.
@@ -1966,7 +2168,7 @@ finish:
 	// macro argument. To pass an empty last argument, use a second
 	// trailing comma.
 	if (!str.empty())
-		return Token(T_(STRING), str);
+		return Token(T_(STRING), Rope(std::move(str)));
 	lexer_SetMode(LEXER_NORMAL);
 
 	if (c == '\r' || c == '\n') {
@@ -1978,6 +2180,12 @@ finish:
 	return Token(T_(YYEOF));
 }
 
+// The loops below only care about a handful of keywords at the start of lines.
+// Checking the first char of an identifier lets them avoid reading it entirely.
+static bool mayStartKeyword(int c, char const *initials) {
+	return startsIdentifier(c) && strchr(initials, toupper(c)) != nullptr;
+}
+
 // This function uses the fact that `if`, etc. constructs are only valid when
 // there's nothing before them on their lines. This enables filtering
 // "meaningful" (= at line start) vs. "meaningless" (everything else) tokens.
@@ -2002,7 +2210,8 @@ static Token skipIfBlock(bool toEndc) {
 					break;
 			}
 
-			if (startsIdentifier(c)) {
+			// Only `IF`, `ELIF`, `ELSE`, and `ENDC` matter here
+			if (mayStartKeyword(c, "IE")) {
 				shiftChar();
 				switch (Token token = readIdentifier(c); token.type) {
 				case T_(POP_IF):
@@ -2039,6 +2248,7 @@ static Token skipIfBlock(bool toEndc) {
 
 		// Read chars until EOL
 		do {
+			skipToLineBreak(true);
 			int c = nextChar();
 
 			if (c == EOF) {
@@ -2088,7 +2298,8 @@ static Token yylex_SKIP_TO_ENDR() {
 				shiftChar();
 			}
 
-			if (startsIdentifier(c)) {
+			// Only `FOR`, `REPT`, `ENDR`, `IF`, and `ENDC` matter here
+			if (mayStartKeyword(c, "FRIE")) {
 				shiftChar();
 				switch (readIdentifier(c).type) {
 				case T_(POP_FOR):
@@ -2119,6 +2330,7 @@ static Token yylex_SKIP_TO_ENDR() {
 
 		// Read chars until EOL
 		do {
+			skipToLineBreak(true);
 			int c = nextChar();
 
 			if (c == EOF) {
@@ -2140,6 +2352,48 @@ static Token yylex_SKIP_TO_ENDR() {
 	}
 }
 
+// Checks whether a file consists only of an `IF !DEF(name)` ... `ENDC` block, so that `INCLUDE`
+// can skip it entirely once `name` is defined
+static void trackIncludeGuard(Token const &token) {
+	static int const guardTokens[] = {
+	    T_(POP_IF), T_(OP_LOGICNOT), T_(OP_DEF), T_(LPAREN), T_(ID), T_(RPAREN), T_(NEWLINE)
+	};
+
+	switch (lexerState->guardState) {
+	case GUARD_NONE:
+	case GUARD_COMPLETE:
+		break;
+
+	case GUARD_MATCHING:
+		// Blank lines (and comments) may precede the include guard
+		if (token.type == T_(NEWLINE) && lexerState->guardTokensMatched == 0)
+			break;
+		if (token.type != guardTokens[lexerState->guardTokensMatched]) {
+			lexerState->guardState = GUARD_NONE;
+			break;
+		}
+		if (token.type == T_(ID))
+			lexerState->guardName = std::get<std::string>(token.value);
+		if (++lexerState->guardTokensMatched == std::size(guardTokens))
+			lexerState->guardState = GUARD_OPEN;
+		break;
+
+	case GUARD_OPEN:
+		// `ELIF` or `ELSE` blocks would still be assembled with the guard symbol defined
+		if ((token.type == T_(POP_ELIF) || token.type == T_(POP_ELSE))
+		    && lexerState->ifStack.size() == 1)
+			lexerState->guardState = GUARD_NONE;
+		break;
+
+	case GUARD_CLOSED:
+		if (token.type == T_(EOB))
+			lexerState->guardState = GUARD_COMPLETE;
+		else if (token.type != T_(NEWLINE))
+			lexerState->guardState = GUARD_NONE;
+		break;
+	}
+}
+
 yy::parser::symbol_type yylex() {
 	if (lexerState->atLineStart && lexerStateEOL) {
 		lexerState = lexerStateEOL;
@@ -2166,10 +2420,21 @@ yy::parser::symbol_type yylex() {
 	lexerState->lastToken = token.type;
 	lexerState->atLineStart = token.type == T_(NEWLINE) || token.type == T_(EOB);
 
+	if (lexerState->guardState != GUARD_NONE)
+		trackIncludeGuard(token);
+
 	if (auto *numValue = std::get_if<uint32_t>(&token.value); numValue) {
 		return yy::parser::symbol_type(token.type, *numValue);
 	} else if (auto *strValue = std::get_if<std::string>(&token.value); strValue) {
-		return yy::parser::symbol_type(token.type, *strValue);
+		// Strings too long to be stored inline would need an allocation to be copied
+		if (strValue->length() > std::string().capacity())
+			nbMovedStrings++;
+		return yy::parser::symbol_type(token.type, std::move(*strValue));
+	} else if (auto *ropeValue = std::get_if<Rope>(&token.value); ropeValue) {
+		// Non-empty ropes' nodes are always allocated
+		if (!ropeValue->empty())
+			nbMovedStrings++;
+		return yy::parser::symbol_type(token.type, std::move(*ropeValue));
 	} else {
 		assume(std::holds_alternative<std::monostate>(token.value));
 		return yy::parser::symbol_type(token.type);
@@ -2186,33 +2451,42 @@ static Capture startCapture() {
 	lexerState->capturing = true;
 	lexerState->captureSize = 0;
 
-	uint32_t lineNo = lexer_GetLineNo();
-	if (auto *view = std::get_if<ViewedContent>(&lexerState->content);
-	    view && lexerState->expansions.empty()) {
-		return {
-		    .lineNo = lineNo, .span = {.ptr = view->makeSharedContentPtr(), .size = 0}
+	// Expansions are disabled while capturing, so the captured chars come from the innermost
+	// non-exhausted expansion, or from the file, until that runs out.
+	// Until then, the capture can share their contents instead of copying them.
+	auto exp = std::find_if(RANGE(lexerState->expansions), [](Expansion const &expansion) {
+		return expansion.offset < expansion.size();
+	});
+	if (exp != lexerState->expansions.end()) {
+		lexerState->captureSlice = {
+		    .ptr = std::shared_ptr<char[]>(exp->contents, &(*exp->contents)[exp->offset]),
+		    .size = exp->size() - exp->offset,
+		};
+	} else if (auto *view = std::get_if<ViewedContent>(&lexerState->content); view) {
+		lexerState->captureSlice = {
+		    .ptr = view->makeSharedContentPtr(), .size = view->span.size - view->offset
         };
 	} else {
-		assume(lexerState->captureBuf == nullptr);
 		lexerState->captureBuf = std::make_shared<std::vector<char>>();
-		// `.span.ptr == nullptr`; indicates to retrieve the capture buffer when done capturing
-		return {
-		    .lineNo = lineNo, .span = {.ptr = nullptr, .size = 0}
-        };
 	}
+
+	return {
+	    .lineNo = lexer_GetLineNo(), .span = {.ptr = nullptr, .size = 0}
+    };
 }
 
 static void endCapture(Capture &capture) {
-	// This being `nullptr` means we're capturing from the capture buffer, which is reallocated
-	// during the whole capture process, and so MUST be retrieved at the end
-	if (!capture.span.ptr)
-		capture.span.ptr = lexerState->makeSharedCaptureBufPtr();
+	// The capture buffer is reallocated during the whole capture process,
+	// and so MUST be retrieved at the end
+	capture.span.ptr = lexerState->captureBuf ? lexerState->makeSharedCaptureBufPtr()
+	                                          : lexerState->captureSlice.ptr;
 	capture.span.size = lexerState->captureSize;
 
 	// ENDR/ENDM or EOF puts us past the start of the line
 	lexerState->atLineStart = false;
 
 	lexerState->capturing = false;
+	lexerState->captureSlice = {.ptr = nullptr, .size = 0};
 	lexerState->captureBuf = nullptr;
 }
 
@@ -2231,7 +2505,7 @@ Capture lexer_CaptureRept() {
 			c = nextChar();
 		} while (isWhitespace(c));
 		// Now, try to match `REPT`, `FOR` or `ENDR` as a **whole** identifier
-		if (startsIdentifier(c)) {
+		if (mayStartKeyword(c, "RFE")) {
 			switch (readIdentifier(c).type) {
 			case T_(POP_REPT):
 			case T_(POP_FOR):
@@ -2256,7 +2530,7 @@ Capture lexer_CaptureRept() {
 		}
 
 		// Just consume characters until EOL or EOF
-		for (;; c = nextChar()) {
+		for (;; skipToLineBreak(false), c = nextChar()) {
 			if (c == EOF) {
 				error("Unterminated REPT/FOR block\n");
 				endCapture(capture);
@@ -2284,7 +2558,7 @@ Capture lexer_CaptureMacro() {
 			c = nextChar();
 		} while (isWhitespace(c));
 		// Now, try to match `ENDM` as a **whole** identifier
-		if (startsIdentifier(c)) {
+		if (mayStartKeyword(c, "E")) {
 			switch (readIdentifier(c).type) {
 			case T_(POP_ENDM):
 				endCapture(capture);
@@ -2299,7 +2573,7 @@ Capture lexer_CaptureMacro() {
 		}
 
 		// Just consume characters until EOL or EOF
-		for (;; c = nextChar()) {
+		for (;; skipToLineBreak(false), c = nextChar()) {
 			if (c == EOF) {
 				error("Unterminated macro definition\n");
 				endCapture(capture);
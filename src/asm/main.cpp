@@ -2,6 +2,7 @@
 
 #include "asm/main.hpp"
 
+#include <inttypes.h>
 #include <limits.h>
 #include <memory>
 #include <stdlib.h>
@@ -14,8 +15,10 @@
 #include "parser.hpp"
 #include "version.hpp"
 
+#include "asm/cache.hpp"
 #include "asm/charmap.hpp"
 #include "asm/fstack.hpp"
+#include "asm/lexer.hpp"
 #include "asm/opt.hpp"
 #include "asm/output.hpp"
 #include "asm/symbol.hpp"
@@ -48,7 +51,7 @@ static std::string make_escape(std::string &str) {
 }
 
 // Short options
-static char const *optstring = "b:D:Eg:I:M:o:P:p:Q:r:VvW:wX:";
+static char const *optstring = "b:C:D:Eg:I:M:o:P:p:Q:r:VvW:wX:";
 
 // Variables for the long-only options
 static int depType; // Variants of `-M`
@@ -63,6 +66,7 @@ static int depType; // Variants of `-M`
 // over short opt matching
 static option const longopts[] = {
     {"binary-digits",    required_argument, nullptr,  'b'},
+    {"cache-dir",        required_argument, nullptr,  'C'},
     {"define",           required_argument, nullptr,  'D'},
     {"export-all",       no_argument,       nullptr,  'E'},
     {"gfx-chars",        required_argument, nullptr,  'g'},
@@ -87,10 +91,10 @@ static option const longopts[] = {
 
 static void printUsage() {
 	fputs(
-	    "Usage: rgbasm [-EVvw] [-b chars] [-D name[=value]] [-g chars] [-I path]\n"
-	    "              [-M depend_file] [-MG] [-MP] [-MT target_file] [-MQ target_file]\n"
-	    "              [-o out_file] [-P include_file] [-p pad_value] [-Q precision]\n"
-	    "              [-r depth] [-W warning] [-X max_errors] <file>\n"
+	    "Usage: rgbasm [-EVvw] [-b chars] [-C cache_dir] [-D name[=value]] [-g chars]\n"
+	    "              [-I path] [-M depend_file] [-MG] [-MP] [-MT target_file]\n"
+	    "              [-MQ target_file] [-o out_file] [-P include_file] [-p pad_value]\n"
+	    "              [-Q precision] [-r depth] [-W warning] [-X max_errors] <file>\n"
 	    "Useful options:\n"
 	    "    -E, --export-all         export all labels\n"
 	    "    -M, --dependfile <path>  set the output dependency file\n"
@@ -135,6 +139,10 @@ int main(int argc, char *argv[]) {
 		maxErrors = 100;
 
 	for (int ch; (ch = musl_getopt_long_only(argc, argv, optstring, longopts, nullptr)) != -1;) {
+		// Options that cannot affect the object file are left out of the cache key
+		if (ch == 0 ? depType == 'G' : !strchr("CMoVv", ch))
+			cache_AddOption(ch ? ch : depType, musl_optarg);
+
 		switch (ch) {
 			char *endptr;
 
@@ -145,6 +153,10 @@ int main(int argc, char *argv[]) {
 				errx("Must specify exactly 2 characters for option 'b'");
 			break;
 
+		case 'C':
+			cache_SetDirectory(musl_optarg);
+			break;
+
 			char *equals;
 		case 'D':
 			equals = strchr(musl_optarg, '=');
@@ -318,6 +330,10 @@ int main(int argc, char *argv[]) {
 		fprintf(dependFile, "%s: %s\n", targetFileName.c_str(), mainFileName.c_str());
 	}
 
+	// If the object file is cached and up to date, there is no need to assemble anything
+	if (cache_Replay(mainFileName))
+		return 0;
+
 	charmap_New(DEFAULT_CHARMAP_NAME, nullptr);
 
 	// Init lexer and file stack, providing file info
@@ -327,6 +343,13 @@ int main(int argc, char *argv[]) {
 	if (yy::parser parser; parser.parse() != 0 && nbErrors == 0)
 		nbErrors = 1;
 
+	if (verbose)
+		printf(
+		    "Lexing all input files moved %" PRIu64
+		    " heap-allocated strings instead of copying them\n",
+		    lexer_GetNbMovedStrings()
+		);
+
 	sect_CheckUnionClosed();
 
 	if (nbErrors != 0)
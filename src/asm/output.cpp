@@ -1,18 +1,25 @@
 /* SPDX-License-Identifier: MIT */
 
 #include "asm/output.hpp"
+#include <sys/stat.h>
 
 #include <deque>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "error.hpp"
-#include "helpers.hpp" // assume, Defer
+#include "helpers.hpp"  // assume, QUOTEDSTRLEN, RANGE
+#include "platform.hpp" // S_ISREG, lstat, mkstemp, realpath
 
+#include "asm/cache.hpp"
 #include "asm/fstack.hpp"
 #include "asm/lexer.hpp"
 #include "asm/main.hpp"
@@ -32,32 +39,118 @@ std::string objectName;
 // List of symbols to put in the object file
 static std::vector<Symbol *> objectSymbols;
 
-static std::deque<Assertion> assertions;
+static std::vector<Assertion> assertions;   // In the order they were created
+static std::vector<uint8_t> assertionRPN; // RPN expressions of all `assertions`, back to back
 
 static std::deque<std::shared_ptr<FileStackNode>> fileStackNodes;
 
-// Write a long to a file (little-endian)
-static void putlong(uint32_t n, FILE *file) {
+static uint32_t getParentID(FileStackNode const &node) {
+	return node.parent ? node.parent->ID : (uint32_t)-1;
+}
+
+// Registered nodes are hash-consed: nodes with the same parent, line, type and name (or REPT
+// iterations) are indistinguishable in the object file, so they share a single ID.
+// This relies on parents being registered (and thus hash-consed) before their children.
+struct NodeHash {
+	size_t operator()(std::shared_ptr<FileStackNode> const &node) const {
+		size_t hash = getParentID(*node) * 31 + node->lineNo;
+		hash = hash * 31 + node->type;
+		if (node->type != NODE_REPT)
+			return hash * 31 + std::hash<std::string>{}(node->name());
+		for (uint32_t iter : node->iters())
+			hash = hash * 31 + iter;
+		return hash;
+	}
+};
+
+struct NodeEqual {
+	bool operator()(
+	    std::shared_ptr<FileStackNode> const &lhs, std::shared_ptr<FileStackNode> const &rhs
+	) const {
+		if (getParentID(*lhs) != getParentID(*rhs) || lhs->lineNo != rhs->lineNo
+		    || lhs->type != rhs->type)
+			return false;
+		return lhs->type == NODE_REPT ? lhs->iters() == rhs->iters() : lhs->name() == rhs->name();
+	}
+};
+
+static std::unordered_set<std::shared_ptr<FileStackNode>, NodeHash, NodeEqual> registeredNodes;
+
+// Append a long to a buffer (little-endian)
+static void putlong(uint32_t n, std::vector<uint8_t> &buf) {
 	uint8_t bytes[] = {
 	    (uint8_t)n,
 	    (uint8_t)(n >> 8),
 	    (uint8_t)(n >> 16),
 	    (uint8_t)(n >> 24),
 	};
-	fwrite(bytes, 1, sizeof(bytes), file);
+	buf.insert(buf.end(), RANGE(bytes));
+}
+
+// Append an unsigned LEB128 varint to a buffer
+static void putvarint(uint32_t n, std::vector<uint8_t> &buf) {
+	uint8_t bytes[5];
+	size_t len = 0;
+
+	do {
+		bytes[len] = n & 0x7F;
+		n >>= 7;
+		if (n)
+			bytes[len] |= 0x80;
+		len++;
+	} while (n);
+	buf.insert(buf.end(), bytes, bytes + len);
+}
+
+// Append a signed LEB128 varint to a buffer, so that e.g. -1 only takes a single byte
+static void putsvarint(int32_t n, std::vector<uint8_t> &buf) {
+	uint8_t bytes[5];
+	size_t len = 0;
+
+	for (;;) {
+		uint8_t byte = n & 0x7F;
+		n >>= 7; // Arithmetic shift, keeping the sign
+		// Stop once the remaining bits are all copies of the byte's sign bit
+		if ((n == 0 && !(byte & 0x40)) || (n == -1 && (byte & 0x40))) {
+			bytes[len++] = byte;
+			break;
+		}
+		bytes[len++] = byte | 0x80;
+	}
+	buf.insert(buf.end(), bytes, bytes + len);
 }
 
-// Write a NUL-terminated string to a file
-static void putstring(std::string const &s, FILE *file) {
-	fputs(s.c_str(), file);
-	putc('\0', file);
+// Strings are written once to the object file's string table, and referenced by ID elsewhere.
+// The strings belong to the nodes, symbols, sections and assertions being written.
+static std::vector<std::string_view> stringTable;
+static std::unordered_map<std::string_view, uint32_t> stringIDs;
+
+static void registerString(std::string const &s) {
+	if (stringIDs.try_emplace(s, stringTable.size()).second)
+		stringTable.push_back(s);
+}
+
+// Append a reference to a registered string to a buffer
+static void putstringid(std::string const &s, std::vector<uint8_t> &buf) {
+	auto search = stringIDs.find(s);
+
+	assume(search != stringIDs.end());
+	putvarint(search->second, buf);
 }
 
 void out_RegisterNode(std::shared_ptr<FileStackNode> node) {
-	// If node is not already registered, register it (and parents), and give it a unique ID
-	for (; node && node->ID == (uint32_t)-1; node = node->parent) {
+	// If node is not already registered, register it (and parents), and give it an ID
+	if (!node || node->ID != (uint32_t)-1)
+		return;
+
+	out_RegisterNode(node->parent);
+
+	if (auto search = registeredNodes.find(node); search != registeredNodes.end()) {
+		node->ID = (*search)->ID; // Reuse the ID of an identical node
+	} else {
 		node->ID = fileStackNodes.size();
 		fileStackNodes.push_front(node);
+		registeredNodes.insert(node);
 	}
 }
 
@@ -72,57 +165,58 @@ static uint32_t getSectIDIfAny(Section *sect) {
 	fatalerror("Unknown section '%s'\n", sect->name.c_str());
 }
 
-// Write a patch to a file
-static void writepatch(Patch const &patch, FILE *file) {
-	assume(patch.src->ID != (uint32_t)-1);
-	putlong(patch.src->ID, file);
-	putlong(patch.lineNo, file);
-	putlong(patch.offset, file);
-	putlong(getSectIDIfAny(patch.pcSection), file);
-	putlong(patch.pcOffset, file);
-	putc(patch.type, file);
-	putlong(patch.rpn.size(), file);
-	fwrite(patch.rpn.data(), 1, patch.rpn.size(), file);
+// Write a patch to a buffer
+static void
+    writepatch(Patch const &patch, std::vector<uint8_t> const &rpn, std::vector<uint8_t> &buf) {
+	putvarint(patch.nodeID, buf);
+	putvarint(patch.lineNo, buf);
+	putvarint(patch.offset, buf);
+	putsvarint(getSectIDIfAny(patch.pcSection), buf);
+	putvarint(patch.pcOffset, buf);
+	buf.push_back(patch.type);
+	putvarint(patch.rpnSize, buf);
+	buf.insert(buf.end(), &rpn[patch.rpnOffset], &rpn[patch.rpnOffset] + patch.rpnSize);
 }
 
-// Write a section to a file
-static void writesection(Section const &sect, FILE *file) {
-	putstring(sect.name, file);
+// Write a section to a buffer
+static void writesection(Section const &sect, std::vector<uint8_t> &buf) {
+	putstringid(sect.name, buf);
 
-	putlong(sect.size, file);
+	putvarint(sect.size, buf);
 
 	bool isUnion = sect.modifier == SECTION_UNION;
 	bool isFragment = sect.modifier == SECTION_FRAGMENT;
 
-	putc(sect.type | isUnion << 7 | isFragment << 6, file);
+	buf.push_back(sect.type | isUnion << 7 | isFragment << 6);
 
-	putlong(sect.org, file);
-	putlong(sect.bank, file);
-	putc(sect.align, file);
-	putlong(sect.alignOfs, file);
+	putsvarint(sect.org, buf);
+	putsvarint(sect.bank, buf);
+	buf.push_back(sect.align);
+	putvarint(sect.alignOfs, buf);
 
 	if (sect_HasData(sect.type)) {
-		fwrite(sect.data.data(), 1, sect.size, file);
-		putlong(sect.patches.size(), file);
+		buf.insert(buf.end(), sect.data.data(), sect.data.data() + sect.size);
+		putvarint(sect.patches.size(), buf);
 
-		for (Patch const &patch : sect.patches)
-			writepatch(patch, file);
+		// Patches have always been written from last to first
+		for (auto it = sect.patches.rbegin(); it != sect.patches.rend(); it++)
+			writepatch(*it, sect.patchRPN, buf);
 	}
 }
 
-// Write a symbol to a file
-static void writesymbol(Symbol const &sym, FILE *file) {
-	putstring(sym.name, file);
+// Write a symbol to a buffer
+static void writesymbol(Symbol const &sym, std::vector<uint8_t> &buf) {
+	putstringid(sym.name, buf);
 	if (!sym.isDefined()) {
-		putc(SYMTYPE_IMPORT, file);
+		buf.push_back(SYMTYPE_IMPORT);
 	} else {
 		assume(sym.src->ID != (uint32_t)-1);
 
-		putc(sym.isExported ? SYMTYPE_EXPORT : SYMTYPE_LOCAL, file);
-		putlong(sym.src->ID, file);
-		putlong(sym.fileLine, file);
-		putlong(getSectIDIfAny(sym.getSection()), file);
-		putlong(sym.getOutputValue(), file);
+		buf.push_back(sym.isExported ? SYMTYPE_EXPORT : SYMTYPE_LOCAL);
+		putvarint(sym.src->ID, buf);
+		putvarint(sym.fileLine, buf);
+		putsvarint(getSectIDIfAny(sym.getSection()), buf);
+		putsvarint(sym.getOutputValue(), buf);
 	}
 }
 
@@ -135,135 +229,122 @@ static void registerUnregisteredSymbol(Symbol &sym) {
 	}
 }
 
-static void writerpn(std::vector<uint8_t> &rpnexpr, std::vector<uint8_t> const &rpn) {
-	std::string symName;
-	size_t rpnptr = 0;
-
-	for (size_t offset = 0; offset < rpn.size();) {
-		uint8_t rpndata = rpn[offset++];
-
-		switch (rpndata) {
-			Symbol *sym;
-			uint32_t value;
-			uint8_t b;
-
-		case RPN_CONST:
+// Serializes an RPN tree in postfix order, writing symbols as constants when they are known
+static void writerpn(std::vector<uint8_t> &rpnexpr, size_t &rpnptr, RPNNode const &node) {
+	if (node.lhs)
+		writerpn(rpnexpr, rpnptr, *node.lhs);
+	if (node.rhs)
+		writerpn(rpnexpr, rpnptr, *node.rhs);
+
+	switch (node.command) {
+		Symbol *sym;
+		uint32_t value;
+
+	case RPN_CONST:
+		value = node.value();
+		rpnexpr[rpnptr++] = RPN_CONST;
+		rpnexpr[rpnptr++] = value & 0xFF;
+		rpnexpr[rpnptr++] = value >> 8;
+		rpnexpr[rpnptr++] = value >> 16;
+		rpnexpr[rpnptr++] = value >> 24;
+		break;
+
+	case RPN_SYM:
+		sym = node.symbol();
+		if (sym->isConstant()) {
 			rpnexpr[rpnptr++] = RPN_CONST;
-			rpnexpr[rpnptr++] = rpn[offset++];
-			rpnexpr[rpnptr++] = rpn[offset++];
-			rpnexpr[rpnptr++] = rpn[offset++];
-			rpnexpr[rpnptr++] = rpn[offset++];
-			break;
-
-		case RPN_SYM:
-			symName.clear();
-			for (;;) {
-				uint8_t c = rpn[offset++];
-				if (c == 0)
-					break;
-				symName += c;
-			}
-
-			// The symbol name is always written expanded
-			sym = sym_FindExactSymbol(symName);
-			if (sym->isConstant()) {
-				rpnexpr[rpnptr++] = RPN_CONST;
-				value = sym_GetConstantValue(symName);
-			} else {
-				rpnexpr[rpnptr++] = RPN_SYM;
-				registerUnregisteredSymbol(*sym); // Ensure that `sym->ID` is set
-				value = sym->ID;
-			}
-
-			rpnexpr[rpnptr++] = value & 0xFF;
-			rpnexpr[rpnptr++] = value >> 8;
-			rpnexpr[rpnptr++] = value >> 16;
-			rpnexpr[rpnptr++] = value >> 24;
-			break;
-
-		case RPN_BANK_SYM:
-			symName.clear();
-			for (;;) {
-				uint8_t c = rpn[offset++];
-				if (c == 0)
-					break;
-				symName += c;
-			}
-
-			// The symbol name is always written expanded
-			sym = sym_FindExactSymbol(symName);
+			value = sym->getConstantValue();
+		} else {
+			rpnexpr[rpnptr++] = RPN_SYM;
 			registerUnregisteredSymbol(*sym); // Ensure that `sym->ID` is set
 			value = sym->ID;
+		}
 
-			rpnexpr[rpnptr++] = RPN_BANK_SYM;
-			rpnexpr[rpnptr++] = value & 0xFF;
-			rpnexpr[rpnptr++] = value >> 8;
-			rpnexpr[rpnptr++] = value >> 16;
-			rpnexpr[rpnptr++] = value >> 24;
-			break;
-
-		case RPN_BANK_SECT:
-			rpnexpr[rpnptr++] = RPN_BANK_SECT;
-			do {
-				b = rpn[offset++];
-				rpnexpr[rpnptr++] = b;
-			} while (b != 0);
-			break;
-
-		case RPN_SIZEOF_SECT:
-			rpnexpr[rpnptr++] = RPN_SIZEOF_SECT;
-			do {
-				b = rpn[offset++];
-				rpnexpr[rpnptr++] = b;
-			} while (b != 0);
-			break;
+		rpnexpr[rpnptr++] = value & 0xFF;
+		rpnexpr[rpnptr++] = value >> 8;
+		rpnexpr[rpnptr++] = value >> 16;
+		rpnexpr[rpnptr++] = value >> 24;
+		break;
+
+	case RPN_BANK_SYM:
+		sym = node.symbol();
+		registerUnregisteredSymbol(*sym); // Ensure that `sym->ID` is set
+		value = sym->ID;
+
+		rpnexpr[rpnptr++] = RPN_BANK_SYM;
+		rpnexpr[rpnptr++] = value & 0xFF;
+		rpnexpr[rpnptr++] = value >> 8;
+		rpnexpr[rpnptr++] = value >> 16;
+		rpnexpr[rpnptr++] = value >> 24;
+		break;
+
+	case RPN_BANK_SECT:
+	case RPN_SIZEOF_SECT:
+	case RPN_STARTOF_SECT: {
+		std::string const &sectName = node.sectionName();
+
+		rpnexpr[rpnptr++] = node.command;
+		memcpy(&rpnexpr[rpnptr], sectName.c_str(), sectName.length() + 1); // Include NUL
+		rpnptr += sectName.length() + 1;
+		break;
+	}
 
-		case RPN_STARTOF_SECT:
-			rpnexpr[rpnptr++] = RPN_STARTOF_SECT;
-			do {
-				b = rpn[offset++];
-				rpnexpr[rpnptr++] = b;
-			} while (b != 0);
-			break;
+	case RPN_SIZEOF_SECTTYPE:
+	case RPN_STARTOF_SECTTYPE:
+		rpnexpr[rpnptr++] = node.command;
+		rpnexpr[rpnptr++] = node.value();
+		break;
 
-		default:
-			rpnexpr[rpnptr++] = rpndata;
-			break;
-		}
+	default:
+		rpnexpr[rpnptr++] = node.command;
+		break;
 	}
 }
 
-static void initpatch(Patch &patch, uint32_t type, Expression const &expr, uint32_t ofs) {
-	patch.type = type;
-	patch.src = fstk_GetFileStack();
+static void initpatch(
+    Patch &patch, std::vector<uint8_t> &rpn, uint32_t type, Expression const &expr, uint32_t ofs
+) {
+	std::shared_ptr<FileStackNode> src = fstk_GetFileStack();
+
 	// All patches are assumed to eventually be written, so the file stack node is registered
-	out_RegisterNode(patch.src);
+	out_RegisterNode(src);
+	patch.type = type;
+	patch.nodeID = src->ID;
 	patch.lineNo = lexer_GetLineNo();
 	patch.offset = ofs;
 	patch.pcSection = sect_GetSymbolSection();
 	patch.pcOffset = sect_GetSymbolOffset();
 
+	patch.rpnOffset = rpn.size();
+
 	if (expr.isKnown()) {
 		// If the RPN expr's value is known, output a constant directly
 		uint32_t val = expr.value();
-		patch.rpn.resize(5);
-		patch.rpn[0] = RPN_CONST;
-		patch.rpn[1] = val & 0xFF;
-		patch.rpn[2] = val >> 8;
-		patch.rpn[3] = val >> 16;
-		patch.rpn[4] = val >> 24;
+		uint8_t bytes[] = {
+		    RPN_CONST,
+		    (uint8_t)val,
+		    (uint8_t)(val >> 8),
+		    (uint8_t)(val >> 16),
+		    (uint8_t)(val >> 24),
+		};
+		patch.rpnSize = sizeof(bytes);
+		rpn.insert(rpn.end(), RANGE(bytes));
 	} else {
-		patch.rpn.resize(expr.rpnPatchSize);
-		writerpn(patch.rpn, expr.rpn);
+		size_t rpnptr = patch.rpnOffset;
+
+		patch.rpnSize = expr.rpnPatchSize;
+		rpn.resize(patch.rpnOffset + patch.rpnSize);
+		writerpn(rpn, rpnptr, *expr.rpn);
+		assume(rpnptr == rpn.size());
 	}
 }
 
 // Create a new patch (includes the rpn expr)
 void out_CreatePatch(uint32_t type, Expression const &expr, uint32_t ofs, uint32_t pcShift) {
 	// Add the patch to the list
-	Patch &patch = currentSection->patches.emplace_front();
+	Patch &patch = currentSection->patches.emplace_back();
 
-	initpatch(patch, type, expr, ofs);
+	initpatch(patch, currentSection->patchRPN, type, expr, ofs);
 
 	// If the patch had a quantity of bytes output before it,
 	// PC is not at the patch's location, but at the location
@@ -275,60 +356,102 @@ void out_CreatePatch(uint32_t type, Expression const &expr, uint32_t ofs, uint32
 void out_CreateAssert(
     AssertionType type, Expression const &expr, std::string const &message, uint32_t ofs
 ) {
-	Assertion &assertion = assertions.emplace_front();
+	Assertion &assertion = assertions.emplace_back();
 
-	initpatch(assertion.patch, type, expr, ofs);
+	initpatch(assertion.patch, assertionRPN, type, expr, ofs);
 	assertion.message = message;
 }
 
-static void writeassert(Assertion &assert, FILE *file) {
-	writepatch(assert.patch, file);
-	putstring(assert.message, file);
+static void writeassert(Assertion &assert, std::vector<uint8_t> &buf) {
+	writepatch(assert.patch, assertionRPN, buf);
+	putstringid(assert.message, buf);
 }
 
-static void writeFileStackNode(FileStackNode const &node, FILE *file) {
-	putlong(node.parent ? node.parent->ID : (uint32_t)-1, file);
-	putlong(node.lineNo, file);
-	putc(node.type, file);
+static void writeFileStackNode(FileStackNode const &node, std::vector<uint8_t> &buf) {
+	putsvarint(getParentID(node), buf);
+	putvarint(node.lineNo, buf);
+	buf.push_back(node.type);
 	if (node.type != NODE_REPT) {
-		putstring(node.name(), file);
+		putstringid(node.name(), buf);
 	} else {
 		std::vector<uint32_t> const &nodeIters = node.iters();
 
-		putlong(nodeIters.size(), file);
+		putvarint(nodeIters.size(), buf);
 		// Iters are stored by decreasing depth, so reverse the order for output
 		for (uint32_t i = nodeIters.size(); i--;)
-			putlong(nodeIters[i], file);
+			putvarint(nodeIters[i], buf);
 	}
 }
 
-// Write an object file
-void out_WriteObject() {
-	FILE *file;
-	if (objectName != "-") {
-		file = fopen(objectName.c_str(), "wb");
-	} else {
-		objectName = "<stdout>";
-		file = fdopen(STDOUT_FILENO, "wb");
+// Upper bound of the object file's size, so that its buffer only needs to be allocated once
+static size_t getObjectSizeBound() {
+	size_t const maxVarintSize = 5;
+	size_t const maxPatchSize = 6 * maxVarintSize + 1; // Excluding the RPN expression itself
+
+	size_t size = QUOTEDSTRLEN(RGBDS_OBJECT_VERSION_STRING) + 4 + 5 * maxVarintSize;
+
+	for (std::string_view s : stringTable)
+		size += s.length() + 1;
+	for (std::shared_ptr<FileStackNode> const &node : fileStackNodes) {
+		size += 3 * maxVarintSize + 1;
+		if (node->type == NODE_REPT)
+			size += node->iters().size() * maxVarintSize;
 	}
-	if (!file)
-		err("Failed to open object file '%s'", objectName.c_str());
-	Defer closeFile{[&] { fclose(file); }};
+	size += objectSymbols.size() * (5 * maxVarintSize + 1);
+	for (Section const &sect : sectionList)
+		size += 6 * maxVarintSize + 2 + sect.size + sect.patches.size() * maxPatchSize
+		        + sect.patchRPN.size();
+	size += assertions.size() * (maxPatchSize + maxVarintSize) + assertionRPN.size();
+
+	return size;
+}
 
+// Write a whole buffer to a file at once, then close it; returns false on failure
+static bool writeAndClose(std::vector<uint8_t> const &buf, FILE *file) {
+	setvbuf(file, nullptr, _IONBF, 0); // The buffer is complete, so don't copy it into another
+	bool written = fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+	return fclose(file) == 0 && written;
+}
+
+// Write an object file
+void out_WriteObject() {
 	// Also write symbols that weren't written above
 	sym_ForEach(registerUnregisteredSymbol);
 
-	fprintf(file, RGBDS_OBJECT_VERSION_STRING);
-	putlong(RGBDS_OBJECT_REV, file);
+	// Register strings in the order they are referenced below
+	for (std::shared_ptr<FileStackNode> const &node : fileStackNodes) {
+		if (node->type != NODE_REPT)
+			registerString(node->name());
+	}
+	for (Symbol const *sym : objectSymbols)
+		registerString(sym->name);
+	for (auto it = sectionList.rbegin(); it != sectionList.rend(); it++)
+		registerString(it->name);
+	for (auto it = assertions.rbegin(); it != assertions.rend(); it++)
+		registerString(it->message);
+
+	// The whole object file is serialized in memory first, and then written at once
+	std::vector<uint8_t> buf;
+	buf.reserve(getObjectSizeBound());
+
+	buf.resize(QUOTEDSTRLEN(RGBDS_OBJECT_VERSION_STRING));
+	memcpy(buf.data(), RGBDS_OBJECT_VERSION_STRING, QUOTEDSTRLEN(RGBDS_OBJECT_VERSION_STRING));
+	putlong(RGBDS_OBJECT_REV, buf);
 
-	putlong(objectSymbols.size(), file);
-	putlong(sectionList.size(), file);
+	putvarint(objectSymbols.size(), buf);
+	putvarint(sectionList.size(), buf);
 
-	putlong(fileStackNodes.size(), file);
+	putvarint(stringTable.size(), buf);
+	for (std::string_view s : stringTable) {
+		// All views are of `std::string`s, thus NUL-terminated; stop at the first NUL, if any
+		buf.insert(buf.end(), s.data(), s.data() + strlen(s.data()) + 1);
+	}
+
+	putvarint(fileStackNodes.size(), buf);
 	for (auto it = fileStackNodes.begin(); it != fileStackNodes.end(); it++) {
 		FileStackNode const &node = **it;
 
-		writeFileStackNode(node, file);
+		writeFileStackNode(node, buf);
 
 		// The list is supposed to have decrementing IDs
 		if (it + 1 != fileStackNodes.end() && it[1]->ID != node.ID - 1)
@@ -341,15 +464,84 @@ void out_WriteObject() {
 	}
 
 	for (Symbol const *sym : objectSymbols)
-		writesymbol(*sym, file);
+		writesymbol(*sym, buf);
 
 	for (auto it = sectionList.rbegin(); it != sectionList.rend(); it++)
-		writesection(*it, file);
+		writesection(*it, buf);
+
+	putvarint(assertions.size(), buf);
 
-	putlong(assertions.size(), file);
+	// Assertions have always been written from last to first
+	for (auto it = assertions.rbegin(); it != assertions.rend(); it++)
+		writeassert(*it, buf);
+
+	out_WriteObjectData(buf);
+	cache_Store(buf);
+}
 
-	for (Assertion &assert : assertions)
-		writeassert(assert, file);
+// Write an already serialized object file
+void out_WriteObjectData(std::vector<uint8_t> const &buf) {
+	if (objectName == "-") {
+		objectName = "<stdout>";
+		FILE *file = fdopen(STDOUT_FILENO, "wb");
+		if (!file || !writeAndClose(buf, file))
+			err("Failed to write object file '%s'", objectName.c_str());
+		return;
+	}
+
+	// Replace the file that symbolic links point to, not the links themselves
+	std::string path = objectName;
+	if (char *realPath = realpath(objectName.c_str(), nullptr); realPath) {
+		path = realPath;
+		free(realPath);
+	}
+
+	// Devices such as `/dev/null`, FIFOs, etc. must be written to, not replaced; so must
+	// symbolic links that point to nothing yet (`realpath` could not resolve them above)
+	struct stat statBuf;
+	bool exists = lstat(path.c_str(), &statBuf) == 0;
+	if (exists && !S_ISREG(statBuf.st_mode)) {
+		FILE *file = fopen(objectName.c_str(), "wb");
+		if (!file)
+			err("Failed to open object file '%s'", objectName.c_str());
+		if (!writeAndClose(buf, file))
+			err("Failed to write object file '%s'", objectName.c_str());
+		return;
+	}
+
+	// Write to a temporary file next to the object file, then rename it over the latter, so that
+	// it is replaced atomically and never seen half-written; the temporary file's name is unique,
+	// so that it neither overwrites another file nor races with concurrent runs
+	std::string tmpName = path + ".XXXXXX";
+	int fd = mkstemp(tmpName.data());
+	if (fd == -1)
+		err("Failed to create temporary object file '%s'", tmpName.c_str());
+#ifdef _WIN32
+	setmode(fd, O_BINARY);
+#else
+	// `mkstemp` only lets the owner read and write, unlike creating the object file would
+	mode_t mask = umask(0);
+	umask(mask);
+	fchmod(fd, exists ? statBuf.st_mode & 07777 : 0666 & ~mask);
+#endif
+	FILE *file = fdopen(fd, "wb");
+	if (!file || !writeAndClose(buf, file)) {
+		int errnum = errno;
+		if (!file)
+			close(fd);
+		remove(tmpName.c_str());
+		errno = errnum;
+		err("Failed to write object file '%s'", tmpName.c_str());
+	}
+#ifdef _WIN32
+	remove(path.c_str()); // Windows' `rename` does not replace existing files
+#endif
+	if (rename(tmpName.c_str(), path.c_str()) != 0) {
+		int errnum = errno;
+		remove(tmpName.c_str());
+		errno = errnum;
+		err("Failed to rename '%s' to object file '%s'", tmpName.c_str(), path.c_str());
+	}
 }
 
 // Set the object filename
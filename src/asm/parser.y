@@ -12,6 +12,7 @@
 
 	#include "asm/lexer.hpp"
 	#include "asm/macro.hpp"
+	#include "asm/rope.hpp"
 	#include "asm/rpn.hpp"
 	#include "asm/section.hpp"
 
@@ -51,6 +52,7 @@
 	#include <string.h>
 	#include <string_view>
 
+	#include "asm/cache.hpp"
 	#include "asm/charmap.hpp"
 	#include "asm/fixpoint.hpp"
 	#include "asm/format.hpp"
@@ -84,6 +86,7 @@
 	    std::string const &spec,
 	    std::vector<std::variant<uint32_t, std::string>> const &args
 	);
+	static std::string const &sectionNameOf(Symbol const &sym);
 	static void compoundAssignment(std::string const &symName, RPNCommand op, int32_t constValue);
 	static void failAssert(AssertionType type);
 	static void failAssertMsg(AssertionType type, std::string const &message);
@@ -116,8 +119,8 @@
 %type <Expression> reloc_16bit_no_str
 %type <int32_t> sect_type
 
-%type <std::string> string
-%type <std::string> strcat_args
+%type <Rope> string
+%type <Rope> strcat_args
 %type <StrFmtArgList> strfmt_args
 %type <StrFmtArgList> strfmt_va_args
 
@@ -125,7 +128,7 @@
 %type <SectionSpec> sect_attrs
 
 %token <int32_t> NUMBER "number"
-%token <std::string> STRING "string"
+%token <Rope> STRING "string"
 
 %token PERIOD "."
 %token COMMA ","
@@ -192,11 +195,11 @@
 %token <std::string> LABEL "label"
 %token <std::string> ID "identifier"
 %token <std::string> LOCAL_ID "local identifier"
-%token <std::string> ANON "anonymous label"
+%token <uint32_t> ANON "anonymous label"
 %type <std::string> def_id
 %type <std::string> redef_id
 %type <std::string> scoped_id
-%type <std::string> scoped_anon_id
+%type <bool> defined_id
 %token POP_EQU "EQU"
 %token POP_EQUAL "="
 %token POP_EQUS "EQUS"
@@ -469,12 +472,13 @@ scoped_id:
 	}
 ;
 
-scoped_anon_id:
+// Whether the argument of `DEF()` is defined
+defined_id:
 	scoped_id {
-		$$ = std::move($1);
+		$$ = sym_FindScopedValidSymbol($1) != nullptr;
 	}
 	| ANON {
-		$$ = std::move($1);
+		$$ = sym_FindAnonLabel($1) != nullptr;
 	}
 ;
 
@@ -517,7 +521,7 @@ macro_args:
 	}
 	| macro_args STRING {
 		$$ = std::move($1);
-		$$->appendArg(std::make_shared<std::string>($2));
+		$$->appendArg($2.sharedStr());
 	}
 ;
 
@@ -648,7 +652,7 @@ opt_list:
 
 opt_list_entry:
 	STRING {
-		opt_Parse($1.c_str());
+		opt_Parse($1.str().c_str());
 	}
 ;
 
@@ -684,13 +688,13 @@ endsection:
 
 fail:
 	POP_FAIL string {
-		fatalerror("%s\n", $2.c_str());
+		fatalerror("%s\n", $2.str().c_str());
 	}
 ;
 
 warn:
 	POP_WARN string {
-		warning(WARNING_USER, "%s\n", $2.c_str());
+		warning(WARNING_USER, "%s\n", $2.str().c_str());
 	}
 ;
 
@@ -719,9 +723,9 @@ assert:
 	}
 	| POP_ASSERT assert_type relocexpr COMMA string {
 		if (!$3.isKnown()) {
-			out_CreateAssert($2, $3, $5, sect_GetOutputOffset());
+			out_CreateAssert($2, $3, $5.str(), sect_GetOutputOffset());
 		} else if ($3.value() == 0) {
-			failAssertMsg($2, $5);
+			failAssertMsg($2, $5.str());
 		}
 	}
 	| POP_STATIC_ASSERT assert_type const {
@@ -730,7 +734,7 @@ assert:
 	}
 	| POP_STATIC_ASSERT assert_type const COMMA string {
 		if ($3 == 0)
-			failAssertMsg($2, $5);
+			failAssertMsg($2, $5.str());
 	}
 ;
 
@@ -753,7 +757,7 @@ shift:
 
 load:
 	POP_LOAD sect_mod string COMMA sect_type sect_org sect_attrs {
-		sect_SetLoadSection($3, (SectionType)$5, $6, $7, $2);
+		sect_SetLoadSection($3.str(), (SectionType)$5, $6, $7, $2);
 	}
 	| POP_ENDL {
 		sect_EndLoadSection();
@@ -968,13 +972,13 @@ def_rl:
 
 def_equs:
 	def_id POP_EQUS string {
-		sym_AddString($1, std::make_shared<std::string>($3));
+		sym_AddString($1, std::move($3));
 	}
 ;
 
 redef_equs:
 	redef_id POP_EQUS string {
-		sym_RedefString($1, std::make_shared<std::string>($3));
+		sym_RedefString($1, std::move($3));
 	}
 ;
 
@@ -1013,7 +1017,7 @@ export_list_entry:
 
 include:
 	label POP_INCLUDE string endofline {
-		fstk_RunInclude($3, false);
+		fstk_RunInclude($3.str(), false);
 		if (failedOnMissingInclude)
 			YYACCEPT;
 	}
@@ -1021,17 +1025,17 @@ include:
 
 incbin:
 	POP_INCBIN string {
-		sect_BinaryFile($2, 0);
+		sect_BinaryFile($2.str(), 0);
 		if (failedOnMissingInclude)
 			YYACCEPT;
 	}
 	| POP_INCBIN string COMMA const {
-		sect_BinaryFile($2, $4);
+		sect_BinaryFile($2.str(), $4);
 		if (failedOnMissingInclude)
 			YYACCEPT;
 	}
 	| POP_INCBIN string COMMA const COMMA const {
-		sect_BinaryFileSlice($2, $4, $6);
+		sect_BinaryFileSlice($2.str(), $4, $6);
 		if (failedOnMissingInclude)
 			YYACCEPT;
 	}
@@ -1039,7 +1043,7 @@ incbin:
 
 charmap:
 	POP_CHARMAP string COMMA const_8bit {
-		charmap_Add($2, (uint8_t)$4);
+		charmap_Add($2.str(), (uint8_t)$4);
 	}
 ;
 
@@ -1070,16 +1074,22 @@ popc:
 	}
 ;
 
-print: POP_PRINT print_exprs trailing_comma;
+print:
+	POP_PRINT print_exprs trailing_comma {
+		cache_DisableStore("PRINT output was printed");
+	}
+;
 
 println:
 	POP_PRINTLN {
 		putchar('\n');
 		fflush(stdout);
+		cache_DisableStore("PRINT output was printed");
 	}
 	| POP_PRINTLN print_exprs trailing_comma {
 		putchar('\n');
 		fflush(stdout);
+		cache_DisableStore("PRINT output was printed");
 	}
 ;
 
@@ -1093,7 +1103,7 @@ print_expr:
 		printf("$%" PRIX32, $1);
 	}
 	| string {
-		fputs($1.c_str(), stdout);
+		fputs($1.str().c_str(), stdout);
 	}
 ;
 
@@ -1122,7 +1132,7 @@ constlist_8bit_entry:
 	| string {
 		std::vector<uint8_t> output;
 
-		charmap_Convert($1, output);
+		charmap_Convert($1.str(), output);
 		sect_AbsByteGroup(output.data(), output.size());
 	}
 ;
@@ -1139,7 +1149,7 @@ constlist_16bit_entry:
 	| string {
 		std::vector<uint8_t> output;
 
-		charmap_Convert($1, output);
+		charmap_Convert($1.str(), output);
 		sect_AbsWordGroup(output.data(), output.size());
 	}
 ;
@@ -1156,7 +1166,7 @@ constlist_32bit_entry:
 	| string {
 		std::vector<uint8_t> output;
 
-		charmap_Convert($1, output);
+		charmap_Convert($1.str(), output);
 		sect_AbsLongGroup(output.data(), output.size());
 	}
 ;
@@ -1208,15 +1218,18 @@ relocexpr:
 	| string {
 		std::vector<uint8_t> output;
 
-		charmap_Convert($1, output);
+		charmap_Convert($1.str(), output);
 		$$.makeNumber(str2int2(output));
 	}
 ;
 
 relocexpr_no_str:
-	scoped_anon_id {
+	scoped_id {
 		$$.makeSymbol($1);
 	}
+	| ANON {
+		$$.makeAnonLabel($1);
+	}
 	| NUMBER {
 		$$.makeNumber($1);
 	}
@@ -1306,18 +1319,21 @@ relocexpr_no_str:
 	| OP_ISCONST LPAREN relocexpr RPAREN {
 		$$.makeNumber($3.isKnown());
 	}
-	| OP_BANK LPAREN scoped_anon_id RPAREN {
+	| OP_BANK LPAREN scoped_id RPAREN {
 		// '@' is also an ID; it is handled here
 		$$.makeBankSymbol($3);
 	}
+	| OP_BANK LPAREN ANON RPAREN {
+		$$.makeBankAnonLabel($3);
+	}
 	| OP_BANK LPAREN string RPAREN {
-		$$.makeBankSection($3);
+		$$.makeBankSection($3.str());
 	}
 	| OP_SIZEOF LPAREN string RPAREN {
-		$$.makeSizeOfSection($3);
+		$$.makeSizeOfSection($3.str());
 	}
 	| OP_STARTOF LPAREN string RPAREN {
-		$$.makeStartOfSection($3);
+		$$.makeStartOfSection($3.str());
 	}
 	| OP_SIZEOF LPAREN sect_type RPAREN {
 		$$.makeSizeOfSectionType((SectionType)$3);
@@ -1327,8 +1343,8 @@ relocexpr_no_str:
 	}
 	| OP_DEF {
 		lexer_ToggleStringExpansion(false);
-	} LPAREN scoped_anon_id RPAREN {
-		$$.makeNumber(sym_FindScopedValidSymbol($4) != nullptr);
+	} LPAREN defined_id RPAREN {
+		$$.makeNumber($4);
 		lexer_ToggleStringExpansion(true);
 	}
 	| OP_ROUND LPAREN const opt_q_arg RPAREN {
@@ -1377,26 +1393,26 @@ relocexpr_no_str:
 		$$.makeNumber(fix_ATan2($3, $5, $6));
 	}
 	| OP_STRCMP LPAREN string COMMA string RPAREN {
-		$$.makeNumber($3.compare($5));
+		$$.makeNumber($3.str().compare($5.str()));
 	}
 	| OP_STRIN LPAREN string COMMA string RPAREN {
-		auto pos = $3.find($5);
+		auto pos = $3.str().find($5.str());
 
 		$$.makeNumber(pos != std::string::npos ? pos + 1 : 0);
 	}
 	| OP_STRRIN LPAREN string COMMA string RPAREN {
-		auto pos = $3.rfind($5);
+		auto pos = $3.str().rfind($5.str());
 
 		$$.makeNumber(pos != std::string::npos ? pos + 1 : 0);
 	}
 	| OP_STRLEN LPAREN string RPAREN {
-		$$.makeNumber(strlenUTF8($3));
+		$$.makeNumber(strlenUTF8($3.str()));
 	}
 	| OP_CHARLEN LPAREN string RPAREN {
-		$$.makeNumber(charlenUTF8($3));
+		$$.makeNumber(charlenUTF8($3.str()));
 	}
 	| OP_INCHARMAP LPAREN string RPAREN {
-		$$.makeNumber(charmap_HasChar($3));
+		$$.makeNumber(charmap_HasChar($3.str()));
 	}
 	| LPAREN relocexpr RPAREN {
 		$$ = std::move($2);
@@ -1447,55 +1463,58 @@ string:
 		$$ = std::move($1);
 	}
 	| OP_STRSUB LPAREN string COMMA const COMMA uconst RPAREN {
-		size_t len = strlenUTF8($3);
+		size_t len = strlenUTF8($3.str());
 		uint32_t pos = adjustNegativePos($5, len, "STRSUB");
 
-		$$ = strsubUTF8($3, pos, $7);
+		$$ = strsubUTF8($3.str(), pos, $7);
 	}
 	| OP_STRSUB LPAREN string COMMA const RPAREN {
-		size_t len = strlenUTF8($3);
+		size_t len = strlenUTF8($3.str());
 		uint32_t pos = adjustNegativePos($5, len, "STRSUB");
 
-		$$ = strsubUTF8($3, pos, pos > len ? 0 : len + 1 - pos);
+		$$ = strsubUTF8($3.str(), pos, pos > len ? 0 : len + 1 - pos);
 	}
 	| OP_CHARSUB LPAREN string COMMA const RPAREN {
-		size_t len = charlenUTF8($3);
+		size_t len = charlenUTF8($3.str());
 		uint32_t pos = adjustNegativePos($5, len, "CHARSUB");
 
-		$$ = charsubUTF8($3, pos);
+		$$ = charsubUTF8($3.str(), pos);
 	}
 	| OP_STRCAT LPAREN RPAREN {
-		$$.clear();
+		$$ = Rope();
 	}
 	| OP_STRCAT LPAREN strcat_args RPAREN {
 		$$ = std::move($3);
 	}
 	| OP_STRUPR LPAREN string RPAREN {
-		$$ = std::move($3);
-		std::transform(RANGE($$), $$.begin(), [](char c) { return toupper(c); });
+		std::string str = $3.str();
+		std::transform(RANGE(str), str.begin(), [](char c) { return toupper(c); });
+		$$ = std::move(str);
 	}
 	| OP_STRLWR LPAREN string RPAREN {
-		$$ = std::move($3);
-		std::transform(RANGE($$), $$.begin(), [](char c) { return tolower(c); });
+		std::string str = $3.str();
+		std::transform(RANGE(str), str.begin(), [](char c) { return tolower(c); });
+		$$ = std::move(str);
 	}
 	| OP_STRRPL LPAREN string COMMA string COMMA string RPAREN {
-		$$ = strrpl($3, $5, $7);
+		$$ = strrpl($3.str(), $5.str(), $7.str());
 	}
 	| OP_STRFMT LPAREN strfmt_args RPAREN {
 		$$ = strfmt($3.format, $3.args);
 	}
-	| POP_SECTION LPAREN scoped_anon_id RPAREN {
+	| POP_SECTION LPAREN scoped_id RPAREN {
 		Symbol *sym = sym_FindScopedValidSymbol($3);
 
 		if (!sym)
 			fatalerror("Unknown symbol \"%s\"\n", $3.c_str());
-		Section const *section = sym->getSection();
+		$$ = sectionNameOf(*sym);
+	}
+	| POP_SECTION LPAREN ANON RPAREN {
+		Symbol *sym = sym_FindAnonLabel($3);
 
-		if (!section)
-			fatalerror("\"%s\" does not belong to any section\n", sym->name.c_str());
-		// Section names are capped by rgbasm's maximum string length,
-		// so this currently can't overflow.
-		$$ = section->name;
+		if (!sym)
+			fatalerror("Unknown anonymous label\n");
+		$$ = sectionNameOf(*sym);
 	}
 ;
 
@@ -1505,7 +1524,7 @@ strcat_args:
 	}
 	| strcat_args COMMA string {
 		$$ = std::move($1);
-		$$.append($3);
+		$$ += $3;
 	}
 ;
 
@@ -1513,7 +1532,7 @@ strfmt_args:
 	  %empty {}
 	| string strfmt_va_args {
 		$$ = std::move($2);
-		$$.format = std::move($1);
+		$$.format = $1.str();
 	}
 ;
 
@@ -1525,13 +1544,13 @@ strfmt_va_args:
 	}
 	| strfmt_va_args COMMA string {
 		$$ = std::move($1);
-		$$.args.push_back(std::move($3));
+		$$.args.push_back($3.str());
 	}
 ;
 
 section:
 	POP_SECTION sect_mod string COMMA sect_type sect_org sect_attrs {
-		sect_NewSection($3, (SectionType)$5, $6, $7, $2);
+		sect_NewSection($3.str(), (SectionType)$5, $6, $7, $2);
 	}
 ;
 
@@ -2562,6 +2581,16 @@ static std::string strfmt(
 	return str;
 }
 
+static std::string const &sectionNameOf(Symbol const &sym) {
+	Section const *section = sym.getSection();
+
+	if (!section)
+		fatalerror("\"%s\" does not belong to any section\n", sym.name.c_str());
+	// Section names are capped by rgbasm's maximum string length,
+	// so this currently can't overflow.
+	return section->name;
+}
+
 static void compoundAssignment(std::string const &symName, RPNCommand op, int32_t constValue) {
 	Expression oldExpr, constExpr, newExpr;
 	int32_t newValue;
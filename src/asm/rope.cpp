@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: MIT */
+
+#include "asm/rope.hpp"
+
+#include <utility>
+#include <vector>
+
+// Flattening a node does not change the string it represents, only how it is stored
+struct RopeNode {
+	size_t length;
+	// Leaves hold their characters, and so do concatenations once they have been flattened
+	mutable std::shared_ptr<std::string> chars;
+	// Concatenations hold their two pieces until they are flattened
+	mutable std::shared_ptr<RopeNode const> lhs;
+	mutable std::shared_ptr<RopeNode const> rhs;
+
+	~RopeNode();
+};
+
+// Accumulated ropes are as deep as the number of concatenations, so they must not be walked
+// recursively, or else they could overflow the stack; this also applies to destroying them.
+static void releasePieces(RopeNode const &node) {
+	if (!node.lhs && !node.rhs)
+		return;
+
+	std::vector<std::shared_ptr<RopeNode const>> pieces;
+	pieces.push_back(std::move(node.lhs));
+	pieces.push_back(std::move(node.rhs));
+	while (!pieces.empty()) {
+		std::shared_ptr<RopeNode const> piece = std::move(pieces.back());
+		pieces.pop_back();
+		// If this is the last reference to the piece, detach its own pieces before it is destroyed
+		if (piece && piece.use_count() == 1) {
+			pieces.push_back(std::move(piece->lhs));
+			pieces.push_back(std::move(piece->rhs));
+		}
+	}
+}
+
+RopeNode::~RopeNode() {
+	releasePieces(*this);
+}
+
+static void flatten(RopeNode const &node) {
+	if (node.chars)
+		return;
+
+	auto chars = std::make_shared<std::string>();
+	chars->reserve(node.length);
+	for (std::vector<RopeNode const *> pending{&node}; !pending.empty();) {
+		RopeNode const *piece = pending.back();
+		pending.pop_back();
+		if (piece->chars) {
+			chars->append(*piece->chars);
+		} else {
+			pending.push_back(piece->rhs.get());
+			pending.push_back(piece->lhs.get());
+		}
+	}
+
+	node.chars = std::move(chars);
+	releasePieces(node); // They are no longer needed, but may still be shared with other ropes
+}
+
+Rope::Rope(std::string &&str) {
+	if (!str.empty())
+		*this = Rope(std::make_shared<std::string>(std::move(str)));
+}
+
+Rope::Rope(std::string const &str) {
+	if (!str.empty())
+		*this = Rope(std::make_shared<std::string>(str));
+}
+
+Rope::Rope(std::shared_ptr<std::string> str) {
+	if (str->empty())
+		return;
+
+	auto leaf = std::make_shared<RopeNode>();
+	leaf->length = str->length();
+	leaf->chars = std::move(str);
+	root = std::move(leaf);
+}
+
+size_t Rope::length() const {
+	return root ? root->length : 0;
+}
+
+Rope &Rope::operator+=(Rope const &other) {
+	if (!other.root)
+		return *this;
+	if (!root) {
+		root = other.root;
+		return *this;
+	}
+
+	auto node = std::make_shared<RopeNode>();
+	node->length = root->length + other.root->length;
+	node->lhs = std::move(root);
+	node->rhs = other.root;
+	root = std::move(node);
+	return *this;
+}
+
+std::string const &Rope::str() const {
+	static std::string const emptyString;
+
+	if (!root)
+		return emptyString;
+	flatten(*root);
+	return *root->chars;
+}
+
+std::shared_ptr<std::string> Rope::sharedStr() const {
+	if (!root)
+		return std::make_shared<std::string>();
+	flatten(*root);
+	return root->chars;
+}
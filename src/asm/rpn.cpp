@@ -6,7 +6,6 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <string_view>
 
 #include "helpers.hpp" // assume
@@ -19,6 +18,41 @@
 
 using namespace std::literals;
 
+uint32_t RPNNode::value() const {
+	assume(std::holds_alternative<uint32_t>(data));
+	return std::get<uint32_t>(data);
+}
+
+Symbol *RPNNode::symbol() const {
+	assume(std::holds_alternative<Symbol *>(data));
+	return std::get<Symbol *>(data);
+}
+
+std::string const &RPNNode::sectionName() const {
+	assume(std::holds_alternative<std::string>(data));
+	return std::get<std::string>(data);
+}
+
+static std::shared_ptr<RPNNode const> makeLeaf(RPNCommand command, decltype(RPNNode::data) data) {
+	return std::make_shared<RPNNode const>(RPNNode{
+	    .command = command, .data = std::move(data), .lhs = nullptr, .rhs = nullptr
+	});
+}
+
+static std::shared_ptr<RPNNode const> makeConst(uint32_t value) {
+	return makeLeaf(RPN_CONST, value);
+}
+
+static std::shared_ptr<RPNNode const> makeOp(
+    RPNCommand command,
+    std::shared_ptr<RPNNode const> lhs,
+    std::shared_ptr<RPNNode const> rhs = nullptr
+) {
+	return std::make_shared<RPNNode const>(RPNNode{
+	    .command = command, .data = std::monostate{}, .lhs = std::move(lhs), .rhs = std::move(rhs)
+	});
+}
+
 int32_t Expression::value() const {
 	assume(std::holds_alternative<int32_t>(data));
 	return std::get<int32_t>(data);
@@ -27,19 +61,13 @@ int32_t Expression::value() const {
 void Expression::clear() {
 	data = 0;
 	isSymbol = false;
-	rpn.clear();
+	rpn = nullptr;
 	rpnPatchSize = 0;
 }
 
-uint8_t *Expression::reserveSpace(uint32_t size) {
-	return reserveSpace(size, size);
-}
-
-uint8_t *Expression::reserveSpace(uint32_t size, uint32_t patchSize) {
-	rpnPatchSize += patchSize;
-	size_t curSize = rpn.size();
-	rpn.resize(curSize + size);
-	return &rpn[curSize];
+void Expression::makeUnaryOp(RPNCommand op) {
+	rpn = makeOp(op, std::move(rpn));
+	rpnPatchSize++;
 }
 
 int32_t Expression::getConstVal() const {
@@ -53,7 +81,7 @@ int32_t Expression::getConstVal() const {
 Symbol const *Expression::symbolOf() const {
 	if (!isSymbol)
 		return nullptr;
-	return sym_FindScopedSymbol((char const *)&rpn[1]);
+	return rpn->symbol();
 }
 
 bool Expression::isDiffConstant(Symbol const *sym) const {
@@ -73,32 +101,50 @@ void Expression::makeNumber(uint32_t value) {
 	data = (int32_t)value;
 }
 
+void Expression::makeUnknownSymbol(Symbol *sym, std::string const &symName) {
+	isSymbol = true;
+
+	data = sym_IsPC(sym) ? "PC is not constant at assembly time"
+	                     : "'"s + symName + "' is not constant at assembly time";
+	rpn = makeLeaf(RPN_SYM, sym);
+	rpnPatchSize = 5; // 1-byte opcode + 4-byte symbol ID
+}
+
 void Expression::makeSymbol(std::string const &symName) {
 	clear();
 	if (Symbol *sym = sym_FindScopedSymbol(symName); sym_IsPC(sym) && !sect_GetSymbolSection()) {
 		error("PC has no value outside a section\n");
 		data = 0;
 	} else if (!sym || !sym->isConstant()) {
-		isSymbol = true;
-
-		data = sym_IsPC(sym) ? "PC is not constant at assembly time"
-		                     : "'"s + symName + "' is not constant at assembly time";
-		sym = sym_Ref(symName);
+		makeUnknownSymbol(sym_Ref(symName), symName);
+	} else {
+		data = (int32_t)sym_GetConstantValue(symName);
+	}
+}
 
-		size_t nameLen = sym->name.length() + 1; // Don't forget NUL!
+void Expression::makeAnonLabel(uint32_t id) {
+	clear();
+	if (Symbol *sym = sym_RefAnonLabel(id); !sym->isConstant())
+		makeUnknownSymbol(sym, sym->name);
+	else
+		data = (int32_t)sym->getConstantValue();
+}
 
-		// 1-byte opcode + 4-byte symbol ID
-		uint8_t *ptr = reserveSpace(nameLen + 1, 5);
-		*ptr++ = RPN_SYM;
-		memcpy(ptr, sym->name.c_str(), nameLen);
+void Expression::makeLabelBank(Symbol *sym, std::string const &symName) {
+	if (sym->getSection() && sym->getSection()->bank != (uint32_t)-1) {
+		// Symbol's section is known and bank is fixed
+		data = (int32_t)sym->getSection()->bank;
 	} else {
-		data = (int32_t)sym_GetConstantValue(symName);
+		data = "\""s + symName + "\"'s bank is not known";
+
+		rpn = makeLeaf(RPN_BANK_SYM, sym);
+		rpnPatchSize = 5; // 1-byte opcode + 4-byte symbol ID
 	}
 }
 
 void Expression::makeBankSymbol(std::string const &symName) {
 	clear();
-	if (Symbol const *sym = sym_FindScopedSymbol(symName); sym_IsPC(sym)) {
+	if (Symbol *sym = sym_FindScopedSymbol(symName); sym_IsPC(sym)) {
 		// The @ symbol is treated differently.
 		if (!currentSection) {
 			error("PC has no bank outside a section\n");
@@ -106,7 +152,8 @@ void Expression::makeBankSymbol(std::string const &symName) {
 		} else if (currentSection->bank == (uint32_t)-1) {
 			data = "Current section's bank is not known";
 
-			*reserveSpace(1) = RPN_BANK_SELF;
+			rpn = makeLeaf(RPN_BANK_SELF, std::monostate{});
+			rpnPatchSize = 1;
 		} else {
 			data = (int32_t)currentSection->bank;
 		}
@@ -117,23 +164,16 @@ void Expression::makeBankSymbol(std::string const &symName) {
 	} else {
 		sym = sym_Ref(symName);
 		assume(sym); // If the symbol didn't exist, it should have been created
-
-		if (sym->getSection() && sym->getSection()->bank != (uint32_t)-1) {
-			// Symbol's section is known and bank is fixed
-			data = (int32_t)sym->getSection()->bank;
-		} else {
-			data = "\""s + symName + "\"'s bank is not known";
-
-			size_t nameLen = sym->name.length() + 1; // Room for NUL!
-
-			// 1-byte opcode + 4-byte sect ID
-			uint8_t *ptr = reserveSpace(nameLen + 1, 5);
-			*ptr++ = RPN_BANK_SYM;
-			memcpy(ptr, sym->name.c_str(), nameLen);
-		}
+		makeLabelBank(sym, symName);
 	}
 }
 
+void Expression::makeBankAnonLabel(uint32_t id) {
+	clear();
+	Symbol *sym = sym_RefAnonLabel(id);
+	makeLabelBank(sym, sym->name);
+}
+
 void Expression::makeBankSection(std::string const &sectName) {
 	clear();
 	if (Section *sect = sect_FindSectionByName(sectName); sect && sect->bank != (uint32_t)-1) {
@@ -141,11 +181,8 @@ void Expression::makeBankSection(std::string const &sectName) {
 	} else {
 		data = "Section \""s + sectName + "\"'s bank is not known";
 
-		size_t nameLen = sectName.length() + 1; // Room for NUL!
-
-		uint8_t *ptr = reserveSpace(nameLen + 1);
-		*ptr++ = RPN_BANK_SECT;
-		memcpy(ptr, sectName.data(), nameLen);
+		rpn = makeLeaf(RPN_BANK_SECT, sectName);
+		rpnPatchSize = sectName.length() + 2; // 1-byte opcode + name + NUL
 	}
 }
 
@@ -156,11 +193,8 @@ void Expression::makeSizeOfSection(std::string const &sectName) {
 	} else {
 		data = "Section \""s + sectName + "\"'s size is not known";
 
-		size_t nameLen = sectName.length() + 1; // Room for NUL!
-
-		uint8_t *ptr = reserveSpace(nameLen + 1);
-		*ptr++ = RPN_SIZEOF_SECT;
-		memcpy(ptr, sectName.data(), nameLen);
+		rpn = makeLeaf(RPN_SIZEOF_SECT, sectName);
+		rpnPatchSize = sectName.length() + 2; // 1-byte opcode + name + NUL
 	}
 }
 
@@ -171,11 +205,8 @@ void Expression::makeStartOfSection(std::string const &sectName) {
 	} else {
 		data = "Section \""s + sectName + "\"'s start is not known";
 
-		size_t nameLen = sectName.length() + 1; // Room for NUL!
-
-		uint8_t *ptr = reserveSpace(nameLen + 1);
-		*ptr++ = RPN_STARTOF_SECT;
-		memcpy(ptr, sectName.data(), nameLen);
+		rpn = makeLeaf(RPN_STARTOF_SECT, sectName);
+		rpnPatchSize = sectName.length() + 2; // 1-byte opcode + name + NUL
 	}
 }
 
@@ -183,58 +214,122 @@ void Expression::makeSizeOfSectionType(SectionType type) {
 	clear();
 	data = "Section type's size is not known";
 
-	uint8_t *ptr = reserveSpace(2);
-	*ptr++ = RPN_SIZEOF_SECTTYPE;
-	*ptr = type;
+	rpn = makeLeaf(RPN_SIZEOF_SECTTYPE, (uint32_t)type);
+	rpnPatchSize = 2; // 1-byte opcode + 1-byte section type
 }
 
 void Expression::makeStartOfSectionType(SectionType type) {
 	clear();
 	data = "Section type's start is not known";
 
-	uint8_t *ptr = reserveSpace(2);
-	*ptr++ = RPN_STARTOF_SECTTYPE;
-	*ptr = type;
+	rpn = makeLeaf(RPN_STARTOF_SECTTYPE, (uint32_t)type);
+	rpnPatchSize = 2; // 1-byte opcode + 1-byte section type
+}
+
+// An expression split into an unknown term and a constant offset added to it
+struct TermOffset {
+	std::shared_ptr<RPNNode const> term; // nullptr if the whole expression is known
+	uint32_t termPatchSize;
+	uint32_t offset;
+	bool hasOffset; // Whether `offset` is a constant of the expression, and not just 0
+};
+
+static TermOffset splitOffset(Expression const &expr) {
+	if (expr.isKnown())
+		return {
+		    .term = nullptr,
+		    .termPatchSize = 0,
+		    .offset = (uint32_t)expr.value(),
+		    .hasOffset = true,
+		};
+
+	RPNNode const &node = *expr.rpn;
+	// A constant operand takes 5 bytes, and the operator 1 more
+	if ((node.command == RPN_ADD || node.command == RPN_SUB) && node.rhs->command == RPN_CONST) {
+		uint32_t value = node.rhs->value();
+		return {
+		    .term = node.lhs,
+		    .termPatchSize = expr.rpnPatchSize - 6,
+		    .offset = node.command == RPN_ADD ? value : -value,
+		    .hasOffset = true,
+		};
+	}
+	if (node.command == RPN_ADD && node.lhs->command == RPN_CONST)
+		return {
+		    .term = node.rhs,
+		    .termPatchSize = expr.rpnPatchSize - 6,
+		    .offset = node.lhs->value(),
+		    .hasOffset = true,
+		};
+
+	return {.term = expr.rpn, .termPatchSize = expr.rpnPatchSize, .offset = 0, .hasOffset = false};
+}
+
+// If an expression is a label plus a constant offset, returns that label
+static Symbol const *labelOf(TermOffset const &split) {
+	if (!split.term || split.term->command != RPN_SYM)
+		return nullptr;
+
+	Symbol const *sym = split.term->symbol();
+	return sym->type == SYM_LABEL ? sym : nullptr;
+}
+
+/*
+ * If an expression is a symbol in a floating section plus a constant offset, gets its offset
+ * from the section's alignment boundary, whose lower `align` bits are the value's.
+ *
+ * @return The symbol's section, or nullptr if the expression is not of that form.
+ */
+static Section const *getAlignedOffset(Expression const &expr, uint32_t &alignedOfs) {
+	TermOffset split = splitOffset(expr);
+
+	if (!split.term || split.term->command != RPN_SYM)
+		return nullptr;
+
+	Symbol const &sym = *split.term->symbol();
+	Section const *sect = sym.getSection();
+
+	if (!sect)
+		return nullptr;
+
+	assume(sym.isNumeric());
+
+	// `sym.getValue()` attempts to add the section's address, but that's "-1"
+	// because the section is floating (otherwise we wouldn't be here)
+	assume(sect->org == (uint32_t)-1);
+	alignedOfs = sym.getValue() + 1 + split.offset + sect->alignOfs;
+	return sect;
 }
 
 /*
  * Attempts to compute a constant binary AND from non-constant operands
- * This is possible if one operand is a symbol belonging to an `ALIGN[N]` section, and the other is
- * a constant that only keeps (some of) the lower N bits.
+ * This is possible if one operand is a symbol (plus an offset) belonging to an `ALIGN[N]`
+ * section, and the other is a constant that only keeps (some of) the lower N bits.
  *
  * @return The constant result if it can be computed, or -1 otherwise.
  */
 static int32_t tryConstMask(Expression const &lhs, Expression const &rhs) {
-	Symbol const *lhsSymbol = lhs.symbolOf();
-	Symbol const *rhsSymbol = lhsSymbol ? nullptr : rhs.symbolOf();
-	bool lhsIsSymbol = lhsSymbol && lhsSymbol->getSection();
-	bool rhsIsSymbol = rhsSymbol && rhsSymbol->getSection();
+	uint32_t alignedOfs;
+	Section const *lhsSect = getAlignedOffset(lhs, alignedOfs);
+	Section const *rhsSect = lhsSect ? nullptr : getAlignedOffset(rhs, alignedOfs);
 
-	if (!lhsIsSymbol && !rhsIsSymbol)
+	if (!lhsSect && !rhsSect)
 		return -1;
 
 	// If the lhs isn't a symbol, try again the other way around
-	Symbol const &sym = lhsIsSymbol ? *lhsSymbol : *rhsSymbol;
-	Expression const &expr = lhsIsSymbol ? rhs : lhs; // Opposite side of `sym`
-
-	assume(sym.isNumeric());
+	Section const &sect = lhsSect ? *lhsSect : *rhsSect;
+	Expression const &expr = lhsSect ? rhs : lhs; // Opposite side of the symbol
 
 	if (!expr.isKnown())
 		return -1;
 	// We can now safely use `expr.value()`
-	Section const &sect = *sym.getSection();
 	int32_t unknownBits = (1 << 16) - (1 << sect.align); // The max alignment is 16
 
 	// The mask must ignore all unknown bits
 	if ((expr.value() & unknownBits) != 0)
 		return -1;
 
-	// `sym.getValue()` attempts to add the section's address, but that's "-1"
-	// because the section is floating (otherwise we wouldn't be here)
-	assume(sect.org == (uint32_t)-1);
-	int32_t symbolOfs = sym.getValue() + 1;
-
-	return (symbolOfs + sect.alignOfs) & ~unknownBits;
+	return alignedOfs & ~unknownBits;
 }
 
 void Expression::makeHigh() {
@@ -242,20 +337,24 @@ void Expression::makeHigh() {
 	if (isKnown()) {
 		data = (int32_t)((uint32_t)value() >> 8 & 0xFF);
 	} else {
-		uint8_t bytes[] = {RPN_CONST, 8, 0, 0, 0, RPN_SHR, RPN_CONST, 0xFF, 0, 0, 0, RPN_AND};
-
-		memcpy(reserveSpace(sizeof(bytes)), bytes, sizeof(bytes));
+		rpn = makeOp(RPN_AND, makeOp(RPN_SHR, std::move(rpn), makeConst(8)), makeConst(0xFF));
+		rpnPatchSize += 12; // Two constants and two operators
 	}
 }
 
 void Expression::makeLow() {
 	isSymbol = false;
+	uint32_t alignedOfs;
+
 	if (isKnown()) {
 		data = value() & 0xFF;
+	} else if (Section const *sect = getAlignedOffset(*this, alignedOfs);
+	           sect && sect->align >= 8) {
+		// Sections aligned to 256 bytes or more have the low byte of their addresses known
+		makeNumber(alignedOfs & 0xFF);
 	} else {
-		uint8_t bytes[] = {RPN_CONST, 0xFF, 0, 0, 0, RPN_AND};
-
-		memcpy(reserveSpace(sizeof(bytes)), bytes, sizeof(bytes));
+		rpn = makeOp(RPN_AND, std::move(rpn), makeConst(0xFF));
+		rpnPatchSize += 6; // One constant and one operator
 	}
 }
 
@@ -264,7 +363,7 @@ void Expression::makeNeg() {
 	if (isKnown()) {
 		data = (int32_t) - (uint32_t)value();
 	} else {
-		*reserveSpace(1) = RPN_NEG;
+		makeUnaryOp(RPN_NEG);
 	}
 }
 
@@ -273,7 +372,7 @@ void Expression::makeNot() {
 	if (isKnown()) {
 		data = ~value();
 	} else {
-		*reserveSpace(1) = RPN_NOT;
+		makeUnaryOp(RPN_NOT);
 	}
 }
 
@@ -282,7 +381,7 @@ void Expression::makeLogicNot() {
 	if (isKnown()) {
 		data = !value();
 	} else {
-		*reserveSpace(1) = RPN_LOGNOT;
+		makeUnaryOp(RPN_LOGNOT);
 	}
 }
 
@@ -420,66 +519,94 @@ void Expression::makeBinaryOp(RPNCommand op, Expression &&src1, Expression const
 		case RPN_SYM:
 			fatalerror("%d is not a binary operator\n", op);
 		}
-	} else if (op == RPN_SUB && src1.isDiffConstant(src2.symbolOf())) {
-		data = src1.symbolOf()->getValue() - src2.symbolOf()->getValue();
 	} else if (int32_t constVal; op == RPN_AND && (constVal = tryConstMask(src1, src2)) != -1) {
 		data = constVal;
+	} else if ((op == RPN_ADD || op == RPN_SUB) && tryFoldOffsets(op, src1, src2)) {
+		// The constant terms of both sides have been folded together
 	} else {
-		// If it's not known, start computing the RPN expression
+		// If it's not known, join both expressions' trees under the operator;
+		// constant operands become constant leaves (1-byte opcode + 4-byte value)
+		std::shared_ptr<RPNNode const> lhs, rhs;
 
-		// Convert the left-hand expression if it's constant
 		if (src1.isKnown()) {
-			uint32_t lval = src1.value();
-			uint8_t bytes[] = {
-			    RPN_CONST,
-			    (uint8_t)lval,
-			    (uint8_t)(lval >> 8),
-			    (uint8_t)(lval >> 16),
-			    (uint8_t)(lval >> 24),
-			};
-			rpn.clear();
-			rpnPatchSize = 0;
-			memcpy(reserveSpace(sizeof(bytes)), bytes, sizeof(bytes));
-
+			lhs = makeConst(src1.value());
+			rpnPatchSize = 5;
 			// Use the other expression's un-const reason
-			data = std::move(src2.data);
+			data = src2.data;
 		} else {
-			// Otherwise just reuse its RPN buffer
+			lhs = std::move(src1.rpn);
 			rpnPatchSize = src1.rpnPatchSize;
-			std::swap(rpn, src1.rpn);
 			data = std::move(src1.data);
 		}
 
-		// Now, merge the right expression into the left one
 		if (src2.isKnown()) {
-			// If the right expression is constant, append a shim instead
-			uint32_t rval = src2.value();
-			uint8_t bytes[] = {
-			    RPN_CONST,
-			    (uint8_t)rval,
-			    (uint8_t)(rval >> 8),
-			    (uint8_t)(rval >> 16),
-			    (uint8_t)(rval >> 24),
-			};
-			uint8_t *ptr = reserveSpace(sizeof(bytes) + 1, sizeof(bytes) + 1);
-			memcpy(ptr, bytes, sizeof(bytes));
-			ptr[sizeof(bytes)] = op;
+			rhs = makeConst(src2.value());
+			rpnPatchSize += 5;
 		} else {
-			// Copy the right RPN and append the operator
-			uint32_t rightRpnSize = src2.rpn.size();
-			uint8_t *ptr = reserveSpace(rightRpnSize + 1, src2.rpnPatchSize + 1);
-			if (rightRpnSize > 0)
-				// If `rightRpnSize == 0`, then `memcpy(ptr, nullptr, rightRpnSize)` would be UB
-				memcpy(ptr, src2.rpn.data(), rightRpnSize);
-			ptr[rightRpnSize] = op;
+			rhs = src2.rpn;
+			rpnPatchSize += src2.rpnPatchSize;
 		}
+
+		rpn = makeOp(op, std::move(lhs), std::move(rhs));
+		rpnPatchSize++;
+	}
+}
+
+/*
+ * Attempts to simplify a sum or difference of two expressions, either or both of which are
+ * unknown, so that it carries at most one constant term:
+ * `(X + c1) - (Y + c2)` becomes `(X - Y) + (c1 - c2)`, and cancels out to a constant if X and Y
+ * are labels in the same section, whose distance is known even if their addresses are not.
+ *
+ * @return Whether the expression has been set.
+ */
+bool Expression::tryFoldOffsets(RPNCommand op, Expression const &src1, Expression const &src2) {
+	TermOffset lhs = splitOffset(src1), rhs = splitOffset(src2);
+
+	if (op == RPN_SUB) {
+		if (Symbol const *sym1 = labelOf(lhs), *sym2 = labelOf(rhs); sym1 && sym2) {
+			if (Section const *sect = sym1->getSection(); sect && sect == sym2->getSection()) {
+				data = (int32_t)(sym1->getValue() + lhs.offset - (sym2->getValue() + rhs.offset));
+				return true;
+			}
+		}
+	}
+
+	// Only a single constant term would be left, so there is nothing to fold
+	if (!lhs.hasOffset || !rhs.hasOffset)
+		return false;
+
+	uint32_t offset = op == RPN_ADD ? lhs.offset + rhs.offset : lhs.offset - rhs.offset;
+
+	if (!lhs.term) {
+		rpn = op == RPN_ADD ? rhs.term : makeOp(RPN_NEG, rhs.term);
+		rpnPatchSize = rhs.termPatchSize + (op == RPN_ADD ? 0 : 1);
+		data = src2.data;
+	} else if (!rhs.term) {
+		rpn = lhs.term;
+		rpnPatchSize = lhs.termPatchSize;
+		data = src1.data;
+	} else {
+		rpn = makeOp(op, lhs.term, rhs.term);
+		rpnPatchSize = lhs.termPatchSize + rhs.termPatchSize + 1;
+		data = src1.data;
+	}
+
+	if (offset != 0) {
+		// Subtract negative offsets, which is what e.g. `Label - 1` would do anyway
+		if ((int32_t)offset < 0)
+			rpn = makeOp(RPN_SUB, std::move(rpn), makeConst(-offset));
+		else
+			rpn = makeOp(RPN_ADD, std::move(rpn), makeConst(offset));
+		rpnPatchSize += 6; // 1-byte opcode + 4-byte value, and the operator
 	}
+	return true;
 }
 
 void Expression::makeCheckHRAM() {
 	isSymbol = false;
 	if (!isKnown()) {
-		*reserveSpace(1) = RPN_HRAM;
+		makeUnaryOp(RPN_HRAM);
 	} else if (int32_t val = value(); val >= 0xFF00 && val <= 0xFFFF) {
 		// That range is valid, but only keep the lower byte
 		data = val & 0xFF;
@@ -490,7 +617,7 @@ void Expression::makeCheckHRAM() {
 
 void Expression::makeCheckRST() {
 	if (!isKnown()) {
-		*reserveSpace(1) = RPN_RST;
+		makeUnaryOp(RPN_RST);
 	} else if (int32_t val = value(); val & ~0x38) {
 		// A valid RST address must be masked with 0x38
 		error("Invalid address $%" PRIx32 " for RST\n", val);
@@ -595,16 +595,32 @@ static void writebyte(uint8_t byte) {
 	growSection(1);
 }
 
+// Writes of 0 bytes may happen with a null `bytes` (e.g. `db ""`), or at the end of the data,
+// and `memcpy`/`memset` may not be passed such pointers even then
+static void writebytes(uint8_t const *bytes, uint32_t length) {
+	if (length == 0)
+		return;
+	memcpy(&currentSection->data[sect_GetOutputOffset()], bytes, length);
+	growSection(length);
+}
+
+static void writefill(uint8_t byte, uint32_t length) {
+	if (length == 0)
+		return;
+	memset(&currentSection->data[sect_GetOutputOffset()], byte, length);
+	growSection(length);
+}
+
 static void writeword(uint16_t b) {
-	writebyte(b & 0xFF);
-	writebyte(b >> 8);
+	uint8_t bytes[] = {(uint8_t)b, (uint8_t)(b >> 8)};
+
+	writebytes(bytes, sizeof(bytes));
 }
 
 static void writelong(uint32_t b) {
-	writebyte(b & 0xFF);
-	writebyte(b >> 8);
-	writebyte(b >> 16);
-	writebyte(b >> 24);
+	uint8_t bytes[] = {(uint8_t)b, (uint8_t)(b >> 8), (uint8_t)(b >> 16), (uint8_t)(b >> 24)};
+
+	writebytes(bytes, sizeof(bytes));
 }
 
 static void createPatch(PatchType type, Expression const &expr, uint32_t pcShift) {
@@ -677,8 +693,7 @@ void sect_AbsByteGroup(uint8_t const *s, size_t length) {
 	if (!reserveSpace(length))
 		return;
 
-	while (length--)
-		writebyte(*s++);
+	writebytes(s, length);
 }
 
 void sect_AbsWordGroup(uint8_t const *s, size_t length) {
@@ -687,8 +702,14 @@ void sect_AbsWordGroup(uint8_t const *s, size_t length) {
 	if (!reserveSpace(length * 2))
 		return;
 
-	while (length--)
-		writeword(*s++);
+	// Each char is output as a zero-extended little-endian word
+	uint8_t *ptr = currentSection->data.data() + sect_GetOutputOffset();
+
+	for (size_t i = 0; i < length; i++) {
+		ptr[i * 2] = s[i];
+		ptr[i * 2 + 1] = 0;
+	}
+	growSection(length * 2);
 }
 
 void sect_AbsLongGroup(uint8_t const *s, size_t length) {
@@ -697,8 +718,13 @@ void sect_AbsLongGroup(uint8_t const *s, size_t length) {
 	if (!reserveSpace(length * 4))
 		return;
 
-	while (length--)
-		writelong(*s++);
+	// Each char is output as a zero-extended little-endian long
+	uint8_t *ptr = currentSection->data.data() + sect_GetOutputOffset();
+
+	memset(ptr, 0, length * 4);
+	for (size_t i = 0; i < length; i++)
+		ptr[i * 4] = s[i];
+	growSection(length * 4);
 }
 
 // Skip this many bytes
@@ -720,8 +746,7 @@ void sect_Skip(uint32_t skip, bool ds) {
 			                  : "DB"
 			);
 		// We know we're in a code SECTION
-		while (skip--)
-			writebyte(fillByte);
+		writefill(fillByte, skip);
 	}
 }
 
@@ -749,16 +774,21 @@ void sect_RelBytes(uint32_t n, std::vector<Expression> &exprs) {
 	if (!reserveSpace(n))
 		return;
 
+	// Write all bytes at once; PC stays at the start of the directive, so patches need no shift
+	uint32_t startOffset = sect_GetOutputOffset();
+	uint8_t *ptr = currentSection->data.data() + startOffset;
+
 	for (uint32_t i = 0; i < n; i++) {
 		Expression &expr = exprs[i % exprs.size()];
 
 		if (!expr.isKnown()) {
-			createPatch(PATCHTYPE_BYTE, expr, i);
-			writebyte(0);
+			out_CreatePatch(PATCHTYPE_BYTE, expr, startOffset + i, 0);
+			ptr[i] = 0;
 		} else {
-			writebyte(expr.value());
+			ptr[i] = expr.value();
 		}
 	}
+	growSection(n);
 }
 
 // Output a relocatable word. Checking will be done to see if
@@ -782,7 +812,7 @@ void sect_RelWord(Expression &expr, uint32_t pcShift) {
 void sect_RelLong(Expression &expr, uint32_t pcShift) {
 	if (!checkcodesection())
 		return;
-	if (!reserveSpace(2))
+	if (!reserveSpace(4))
 		return;
 
 	if (!expr.isKnown()) {
@@ -825,62 +855,50 @@ void sect_PCRelByte(Expression &expr, uint32_t pcShift) {
 	}
 }
 
-// Output a binary file
-void sect_BinaryFile(std::string const &name, int32_t startPos) {
-	if (startPos < 0) {
-		error("Start position cannot be negative (%" PRId32 ")\n", startPos);
-		startPos = 0;
-	}
-	if (!checkcodesection())
-		return;
+// Gets the contents of an INCBIN file, or nothing if it could not be opened; only up to `maxSize`
+// bytes of them are read if the file cannot be mapped (e.g. a device or FIFO)
+static std::optional<ContentSpan> readBinaryFile(std::string const &name, size_t maxSize) {
+	std::optional<ContentSpan> contents;
 
-	FILE *file = nullptr;
 	if (std::optional<std::string> fullPath = fstk_FindFile(name); fullPath)
-		file = fopen(fullPath->c_str(), "rb");
-	if (!file) {
+		contents = lexer_ReadFile(*fullPath, maxSize);
+	if (!contents) {
 		if (generatedMissingIncludes) {
 			if (verbose)
 				printf("Aborting (-MG) on INCBIN file '%s' (%s)\n", name.c_str(), strerror(errno));
 			failedOnMissingInclude = true;
-			return;
+		} else {
+			error("Error opening INCBIN file '%s': %s\n", name.c_str(), strerror(errno));
 		}
-		error("Error opening INCBIN file '%s': %s\n", name.c_str(), strerror(errno));
-		return;
 	}
-	Defer closeFile{[&] { fclose(file); }};
-
-	int32_t fsize = -1;
-	int byte;
+	return contents;
+}
 
-	if (fseek(file, 0, SEEK_END) != -1) {
-		fsize = ftell(file);
+// Output a binary file
+void sect_BinaryFile(std::string const &name, int32_t startPos) {
+	if (startPos < 0) {
+		error("Start position cannot be negative (%" PRId32 ")\n", startPos);
+		startPos = 0;
+	}
+	if (!checkcodesection())
+		return;
 
-		if (startPos > fsize) {
-			error("Specified start position is greater than length of file\n");
-			return;
-		}
+	std::optional<ContentSpan> contents = readBinaryFile(name, SIZE_MAX);
+	if (!contents)
+		return;
 
-		fseek(file, startPos, SEEK_SET);
-		if (!reserveSpace(fsize - startPos))
-			return;
-	} else {
-		if (errno != ESPIPE)
-			error(
-			    "Error determining size of INCBIN file '%s': %s\n", name.c_str(), strerror(errno)
-			);
-		// The file isn't seekable, so we'll just skip bytes
-		while (startPos--)
-			(void)fgetc(file);
+	if ((uint32_t)startPos > contents->size) {
+		error("Specified start position is greater than length of file\n");
+		return;
 	}
 
-	while ((byte = fgetc(file)) != EOF) {
-		if (fsize == -1)
-			growSection(1);
-		writebyte(byte);
-	}
+	uint32_t length = contents->size - startPos;
 
-	if (ferror(file))
-		error("Error reading INCBIN file '%s': %s\n", name.c_str(), strerror(errno));
+	if (length == 0) // The file may be empty, without anything to point to
+		return;
+	if (!reserveSpace(length))
+		return;
+	writebytes((uint8_t const *)&contents->ptr[startPos], length);
 }
 
 void sect_BinaryFileSlice(std::string const &name, int32_t startPos, int32_t length) {
@@ -901,64 +919,29 @@ void sect_BinaryFileSlice(std::string const &name, int32_t startPos, int32_t len
 	if (!reserveSpace(length))
 		return;
 
-	FILE *file = nullptr;
-	if (std::optional<std::string> fullPath = fstk_FindFile(name); fullPath)
-		file = fopen(fullPath->c_str(), "rb");
-	if (!file) {
-		if (generatedMissingIncludes) {
-			if (verbose)
-				printf("Aborting (-MG) on INCBIN file '%s' (%s)\n", name.c_str(), strerror(errno));
-			failedOnMissingInclude = true;
-		} else {
-			error("Error opening INCBIN file '%s': %s\n", name.c_str(), strerror(errno));
-		}
+	// Nothing past the slice is needed, so don't read further than that
+	std::optional<ContentSpan> contents = readBinaryFile(name, (size_t)startPos + length);
+	if (!contents)
 		return;
-	}
-	Defer closeFile{[&] { fclose(file); }};
 
-	int32_t fsize;
+	uint32_t fsize = contents->size;
 
-	if (fseek(file, 0, SEEK_END) != -1) {
-		fsize = ftell(file);
-
-		if (startPos > fsize) {
-			error("Specified start position is greater than length of file\n");
-			return;
-		}
-
-		if ((startPos + length) > fsize) {
-			error(
-			    "Specified range in INCBIN is out of bounds (%" PRIu32 " + %" PRIu32 " > %" PRIu32
-			    ")\n",
-			    startPos,
-			    length,
-			    fsize
-			);
-			return;
-		}
-
-		fseek(file, startPos, SEEK_SET);
-	} else {
-		if (errno != ESPIPE)
-			error(
-			    "Error determining size of INCBIN file '%s': %s\n", name.c_str(), strerror(errno)
-			);
-		// The file isn't seekable, so we'll just skip bytes
-		while (startPos--)
-			(void)fgetc(file);
+	if ((uint32_t)startPos > fsize) {
+		error("Specified start position is greater than length of file\n");
+		return;
 	}
 
-	while (length--) {
-		int byte = fgetc(file);
-
-		if (byte != EOF) {
-			writebyte(byte);
-		} else if (ferror(file)) {
-			error("Error reading INCBIN file '%s': %s\n", name.c_str(), strerror(errno));
-		} else {
-			error("Premature end of file (%" PRId32 " bytes left to read)\n", length + 1);
-		}
+	if ((uint32_t)startPos + length > fsize) {
+		error(
+		    "Specified range in INCBIN is out of bounds (%" PRIu32 " + %" PRIu32 " > %" PRIu32 ")\n",
+		    startPos,
+		    length,
+		    fsize
+		);
+		return;
 	}
+
+	writebytes((uint8_t const *)&contents->ptr[startPos], length);
 }
 
 // Section stack routines
@@ -2,14 +2,18 @@
 
 #include "asm/symbol.hpp"
 
+#include <algorithm>
+#include <deque>
 #include <inttypes.h>
 #include <stdio.h>
 #include <unordered_map>
+#include <vector>
 
 #include "error.hpp"
-#include "helpers.hpp" // assume
+#include "helpers.hpp" // assume, RANGE
 #include "version.hpp"
 
+#include "asm/cache.hpp"
 #include "asm/fstack.hpp"
 #include "asm/lexer.hpp"
 #include "asm/macro.hpp"
@@ -18,12 +22,56 @@
 
 using namespace std::literals;
 
-std::unordered_map<std::string, Symbol> symbols;
+// The name of a local label as its scope and suffix, to look it up without concatenating them
+struct ScopedName {
+	std::string_view scope;
+	std::string_view suffix; // Including the leading '.'
+};
+
+// Symbol names are hashed with FNV-1a, which can hash a `ScopedName`'s parts one after the other
+struct SymbolNameHash {
+	using is_transparent = void;
+
+	static size_t hashChars(size_t hash, std::string_view str) {
+		for (char c : str)
+			hash = (hash ^ (uint8_t)c) * 16777619;
+		return hash;
+	}
+
+	size_t operator()(std::string_view name) const { return hashChars(2166136261u, name); }
+	size_t operator()(ScopedName const &name) const {
+		return hashChars(hashChars(2166136261u, name.scope), name.suffix);
+	}
+};
+
+struct SymbolNameEqual {
+	using is_transparent = void;
+
+	bool operator()(std::string_view lhs, std::string_view rhs) const { return lhs == rhs; }
+	bool operator()(std::string_view lhs, ScopedName const &rhs) const {
+		return lhs.length() == rhs.scope.length() + rhs.suffix.length()
+		       && lhs.starts_with(rhs.scope) && lhs.ends_with(rhs.suffix);
+	}
+	bool operator()(ScopedName const &lhs, std::string_view rhs) const {
+		return (*this)(rhs, lhs);
+	}
+};
+
+// Symbols are keyed by views of their own names (see `createSymbol`), so names are only stored
+// once, and their hashes are cached alongside them
+static std::unordered_map<std::string_view, Symbol, SymbolNameHash, SymbolNameEqual> symbols;
+
+// Anonymous labels (and references to them), indexed by their ID; they are only looked up by ID,
+// never by name, so `!N` names (which can only be defined with `-D`) stay in `symbols`.
+// References can only point as many labels ahead as they have `+`, so this is kept small.
+static std::deque<std::optional<Symbol>> anonLabels;
+static uint32_t anonLabelID = 0;
 
 static std::optional<std::string> labelScope = std::nullopt; // Current section's label scope
 static Symbol *PCSymbol;
 static Symbol *_NARGSymbol;
 static Symbol *_RSSymbol;
+static std::vector<Symbol *> timeSymbols; // Built-ins whose values depend on the current time
 static char savedTIME[256];
 static char savedDATE[256];
 static char savedTIMESTAMP_ISO8601_LOCAL[256];
@@ -37,6 +85,10 @@ bool sym_IsPC(Symbol const *sym) {
 void sym_ForEach(void (*callback)(Symbol &)) {
 	for (auto &it : symbols)
 		callback(it.second);
+	for (std::optional<Symbol> &anonLabel : anonLabels) {
+		if (anonLabel)
+			callback(*anonLabel);
+	}
 }
 
 static int32_t Callback_NARG() {
@@ -72,14 +124,19 @@ int32_t Symbol::getOutputValue() const {
 	}
 }
 
-ContentSpan const &Symbol::getMacro() const {
-	assume((std::holds_alternative<ContentSpan>(data)));
-	return std::get<ContentSpan>(data);
+Macro &Symbol::getMacro() {
+	assume((std::holds_alternative<std::shared_ptr<Macro>>(data)));
+	return *std::get<std::shared_ptr<Macro>>(data);
+}
+
+Macro const &Symbol::getMacro() const {
+	assume((std::holds_alternative<std::shared_ptr<Macro>>(data)));
+	return *std::get<std::shared_ptr<Macro>>(data);
 }
 
-std::shared_ptr<std::string> Symbol::getEqus() const {
-	assume(std::holds_alternative<std::shared_ptr<std::string>>(data));
-	return std::get<std::shared_ptr<std::string>>(data);
+Rope const &Symbol::getEqus() const {
+	assume(std::holds_alternative<Rope>(data));
+	return std::get<Rope>(data);
 }
 
 static void dumpFilename(Symbol const &sym) {
@@ -104,11 +161,7 @@ static void updateSymbolFilename(Symbol &sym) {
 		out_RegisterNode(sym.src);
 }
 
-// Create a new symbol by name
-static Symbol &createSymbol(std::string const &symName) {
-	Symbol &sym = symbols[symName];
-
-	sym.name = symName;
+static Symbol &initSymbol(Symbol &sym) {
 	sym.isExported = false;
 	sym.isBuiltin = false;
 	sym.section = nullptr;
@@ -119,9 +172,42 @@ static Symbol &createSymbol(std::string const &symName) {
 	return sym;
 }
 
+// Create a new symbol by name
+static Symbol &createSymbol(std::string const &symName) {
+	assume(!sym_FindExactSymbol(symName));
+
+	// The symbol's key must view its own name, so change it once the symbol exists
+	auto node = symbols.extract(symbols.try_emplace(symName).first);
+	Symbol &sym = node.mapped();
+	sym.name = symName;
+	node.key() = sym.name;
+	symbols.insert(std::move(node));
+
+	return initSymbol(sym);
+}
+
+// Create a new anonymous label (or reference to one) by ID
+static Symbol &createAnonLabel(uint32_t id) {
+	assume(!sym_FindAnonLabel(id));
+
+	// Anonymous labels may be referenced before being created, leaving gaps
+	if (id >= anonLabels.size())
+		anonLabels.resize(id + 1);
+	Symbol &sym = anonLabels[id].emplace();
+	sym.name = "!"s + std::to_string(id);
+
+	return initSymbol(sym);
+}
+
 Symbol *sym_FindExactSymbol(std::string const &symName) {
 	auto search = symbols.find(symName);
-	return search != symbols.end() ? &search->second : nullptr;
+	if (search == symbols.end())
+		return nullptr;
+
+	Symbol *sym = &search->second;
+	if (sym->isBuiltin && std::find(RANGE(timeSymbols), sym) != timeSymbols.end())
+		cache_DisableStore("the current time was used");
+	return sym;
 }
 
 Symbol *sym_FindScopedSymbol(std::string const &symName) {
@@ -130,9 +216,11 @@ Symbol *sym_FindScopedSymbol(std::string const &symName) {
 			fatalerror(
 			    "'%s' is a nonsensical reference to a nested local symbol\n", symName.c_str()
 			);
-		// If auto-scoped local label, expand the name
-		if (dotPos == 0 && labelScope)
-			return sym_FindExactSymbol(*labelScope + symName);
+		// If auto-scoped local label, look it up under its scope
+		if (dotPos == 0 && labelScope) {
+			auto search = symbols.find(ScopedName{.scope = *labelScope, .suffix = symName});
+			return search != symbols.end() ? &search->second : nullptr;
+		}
 	}
 	return sym_FindExactSymbol(symName);
 }
@@ -169,7 +257,8 @@ void sym_Purge(std::string const &symName) {
 		// Do not keep a reference to the label's name after purging it
 		if (sym->name == labelScope)
 			labelScope = std::nullopt;
-		symbols.erase(sym->name);
+		// Erase by iterator, since the key views the name of the symbol being erased
+		symbols.erase(symbols.find(sym->name));
 	}
 }
 
@@ -296,22 +385,22 @@ Symbol *sym_RedefEqu(std::string const &symName, int32_t value) {
  * of the string are enough: sym_AddString("M_PI"s, "3.1415"). This is the same
  * as ``` M_PI EQUS "3.1415" ```
  */
-Symbol *sym_AddString(std::string const &symName, std::shared_ptr<std::string> str) {
+Symbol *sym_AddString(std::string const &symName, Rope str) {
 	Symbol *sym = createNonrelocSymbol(symName, false);
 
 	if (!sym)
 		return nullptr;
 
 	sym->type = SYM_EQUS;
-	sym->data = str;
+	sym->data = std::move(str);
 	return sym;
 }
 
-Symbol *sym_RedefString(std::string const &symName, std::shared_ptr<std::string> str) {
+Symbol *sym_RedefString(std::string const &symName, Rope str) {
 	Symbol *sym = sym_FindExactSymbol(symName);
 
 	if (!sym)
-		return sym_AddString(symName, str);
+		return sym_AddString(symName, std::move(str));
 
 	if (sym->type != SYM_EQUS) {
 		if (sym->isDefined())
@@ -326,7 +415,7 @@ Symbol *sym_RedefString(std::string const &symName, std::shared_ptr<std::string>
 	}
 
 	updateSymbolFilename(*sym);
-	sym->data = str;
+	sym->data = std::move(str);
 
 	return sym;
 }
@@ -376,8 +465,7 @@ static Symbol *addLabel(std::string const &symName) {
 	// If the symbol already exists as a ref, just "take over" it
 	sym->type = SYM_LABEL;
 	sym->data = (int32_t)sect_GetSymbolOffset();
-	// Don't export anonymous labels
-	if (exportAll && !symName.starts_with('!'))
+	if (exportAll)
 		sym->isExported = true;
 	sym->section = sect_GetSymbolSection();
 
@@ -424,8 +512,6 @@ Symbol *sym_AddLabel(std::string const &symName) {
 	return sym;
 }
 
-static uint32_t anonLabelID = 0;
-
 // Add an anonymous label
 Symbol *sym_AddAnonLabel() {
 	if (anonLabelID == UINT32_MAX) {
@@ -433,13 +519,26 @@ Symbol *sym_AddAnonLabel() {
 		return nullptr;
 	}
 
-	std::string anon = sym_MakeAnonLabelName(0, true); // The direction is important!
-	anonLabelID++;
-	return addLabel(anon);
+	uint32_t id = anonLabelID++;
+	Symbol *sym = sym_FindAnonLabel(id);
+
+	// If the label was referenced earlier, just "take over" the reference
+	if (!sym)
+		sym = &createAnonLabel(id);
+	else
+		updateSymbolFilename(*sym);
+	sym->type = SYM_LABEL; // Unlike other labels, anonymous ones are never exported
+	sym->data = (int32_t)sect_GetSymbolOffset();
+	sym->section = sect_GetSymbolSection();
+
+	if (!sym->section)
+		error("Label \"%s\" created outside of a SECTION\n", sym->name.c_str());
+
+	return sym;
 }
 
-// Write an anonymous label's name to a buffer
-std::string sym_MakeAnonLabelName(uint32_t ofs, bool neg) {
+// Get the ID of the anonymous label `ofs` labels before or after the current position
+uint32_t sym_GetAnonLabelID(uint32_t ofs, bool neg) {
 	uint32_t id = 0;
 
 	if (neg) {
@@ -466,9 +565,21 @@ std::string sym_MakeAnonLabelName(uint32_t ofs, bool neg) {
 			id = anonLabelID + ofs;
 	}
 
-	std::string anon("!");
-	anon += std::to_string(id);
-	return anon;
+	return id;
+}
+
+Symbol *sym_FindAnonLabel(uint32_t id) {
+	return id < anonLabels.size() && anonLabels[id] ? &*anonLabels[id] : nullptr;
+}
+
+Symbol *sym_RefAnonLabel(uint32_t id) {
+	Symbol *sym = sym_FindAnonLabel(id);
+
+	if (!sym) {
+		sym = &createAnonLabel(id);
+		sym->type = SYM_REF;
+	}
+	return sym;
 }
 
 // Export a symbol
@@ -494,7 +605,7 @@ Symbol *sym_AddMacro(std::string const &symName, int32_t defLineNo, ContentSpan
 		return nullptr;
 
 	sym->type = SYM_MACRO;
-	sym->data = span;
+	sym->data = std::make_shared<Macro>(Macro{.span = span, .contextName = nullptr});
 
 	sym->src = fstk_GetFileStack();
 	// The symbol is created at the line after the `ENDM`,
@@ -581,19 +692,22 @@ void sym_Init(time_t now) {
 	    time_utc
 	);
 
-	sym_AddString("__TIME__"s, std::make_shared<std::string>(savedTIME))->isBuiltin = true;
-	sym_AddString("__DATE__"s, std::make_shared<std::string>(savedDATE))->isBuiltin = true;
-	sym_AddString(
-	    "__ISO_8601_LOCAL__"s, std::make_shared<std::string>(savedTIMESTAMP_ISO8601_LOCAL)
-	)
-	    ->isBuiltin = true;
-	sym_AddString("__ISO_8601_UTC__"s, std::make_shared<std::string>(savedTIMESTAMP_ISO8601_UTC))
-	    ->isBuiltin = true;
-
-	sym_AddEqu("__UTC_YEAR__"s, time_utc->tm_year + 1900)->isBuiltin = true;
-	sym_AddEqu("__UTC_MONTH__"s, time_utc->tm_mon + 1)->isBuiltin = true;
-	sym_AddEqu("__UTC_DAY__"s, time_utc->tm_mday)->isBuiltin = true;
-	sym_AddEqu("__UTC_HOUR__"s, time_utc->tm_hour)->isBuiltin = true;
-	sym_AddEqu("__UTC_MINUTE__"s, time_utc->tm_min)->isBuiltin = true;
-	sym_AddEqu("__UTC_SECOND__"s, time_utc->tm_sec)->isBuiltin = true;
+	timeSymbols = {
+	    sym_AddString("__TIME__"s, std::make_shared<std::string>(savedTIME)),
+	    sym_AddString("__DATE__"s, std::make_shared<std::string>(savedDATE)),
+	    sym_AddString(
+	        "__ISO_8601_LOCAL__"s, std::make_shared<std::string>(savedTIMESTAMP_ISO8601_LOCAL)
+	    ),
+	    sym_AddString(
+	        "__ISO_8601_UTC__"s, std::make_shared<std::string>(savedTIMESTAMP_ISO8601_UTC)
+	    ),
+	    sym_AddEqu("__UTC_YEAR__"s, time_utc->tm_year + 1900),
+	    sym_AddEqu("__UTC_MONTH__"s, time_utc->tm_mon + 1),
+	    sym_AddEqu("__UTC_DAY__"s, time_utc->tm_mday),
+	    sym_AddEqu("__UTC_HOUR__"s, time_utc->tm_hour),
+	    sym_AddEqu("__UTC_MINUTE__"s, time_utc->tm_min),
+	    sym_AddEqu("__UTC_SECOND__"s, time_utc->tm_sec),
+	};
+	for (Symbol *sym : timeSymbols)
+		sym->isBuiltin = true;
 }
@@ -13,6 +13,7 @@
 #include "helpers.hpp" // QUOTEDSTRLEN
 #include "itertools.hpp"
 
+#include "asm/cache.hpp"
 #include "asm/fstack.hpp"
 #include "asm/lexer.hpp"
 #include "asm/main.hpp"
@@ -335,6 +336,8 @@ void printDiag(
 	fputs("\n    ", stderr);
 	vfprintf(stderr, fmt, args);
 	lexer_DumpStringExpansions();
+
+	cache_DisableStore("diagnostics were printed");
 }
 
 void error(char const *fmt, ...) {
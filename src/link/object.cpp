@@ -28,6 +28,10 @@
 static std::deque<std::vector<Symbol>> symbolLists;
 static std::vector<std::vector<FileStackNode>> nodes;
 
+// Revision of the object file being read, and its string table (empty for legacy revisions)
+static uint32_t objectRev;
+static std::vector<std::string> objectStrings;
+
 // Helper functions for reading object files
 
 // Internal, DO NOT USE.
@@ -79,6 +83,75 @@ static int64_t readlong(FILE *file) {
 #define tryReadlong(var, file, ...) \
 	tryRead(readlong, int64_t, INT64_MAX, long, var, file, __VA_ARGS__)
 
+/*
+ * Reads an unsigned LEB128 varint from a file.
+ * @param file The file to read from. This will read 1 to 5 bytes from the file.
+ * @return The value read, cast to a int64_t, or INT64_MAX on failure.
+ */
+static int64_t readvarint(FILE *file) {
+	uint32_t value = 0;
+
+	for (uint8_t shift = 0; shift < sizeof(value) * CHAR_BIT; shift += 7) {
+		int byte = getc(file);
+
+		if (byte == EOF)
+			return INT64_MAX;
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	errno = EOVERFLOW; // More bytes than a 32-bit value can need
+	return INT64_MAX;
+}
+
+/*
+ * Reads a signed LEB128 varint from a file.
+ * @param file The file to read from. This will read 1 to 5 bytes from the file.
+ * @return The value read, cast to a int64_t, or INT64_MAX on failure.
+ */
+static int64_t readsvarint(FILE *file) {
+	uint32_t value = 0;
+
+	for (uint8_t shift = 0; shift < sizeof(value) * CHAR_BIT; shift += 7) {
+		int byte = getc(file);
+
+		if (byte == EOF)
+			return INT64_MAX;
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			// Sign-extend from the last byte's top bit
+			if (shift < sizeof(value) * CHAR_BIT - 7 && (byte & 0x40))
+				value |= UINT32_MAX << (shift + 7);
+			return (int32_t)value;
+		}
+	}
+	errno = EOVERFLOW; // More bytes than a 32-bit value can need
+	return INT64_MAX;
+}
+
+// Reads an unsigned field, whose encoding depends on the object file's revision
+static int64_t readfield(FILE *file) {
+	return objectRev == RGBDS_OBJECT_REV_LEGACY ? readlong(file) : readvarint(file);
+}
+
+// Reads a signed field, whose encoding depends on the object file's revision
+static int64_t readsfield(FILE *file) {
+	return objectRev == RGBDS_OBJECT_REV_LEGACY ? readlong(file) : readsvarint(file);
+}
+
+/*
+ * Helper macros for reading numeric fields from a file, and errors out if it fails to.
+ * Legacy revisions store them as longs, newer ones as (signed or unsigned) varints.
+ * @param var The variable to stash the number into
+ * @param file The file to read from. Its position will be advanced
+ * @param ... A format string and related arguments; note that an extra string
+ *            argument is provided, the reason for failure
+ */
+#define tryReadfield(var, file, ...) \
+	tryRead(readfield, int64_t, INT64_MAX, long, var, file, __VA_ARGS__)
+#define tryReadsfield(var, file, ...) \
+	tryRead(readsfield, int64_t, INT64_MAX, long, var, file, __VA_ARGS__)
+
 // There is no `readbyte`, just use `fgetc` or `getc`.
 
 /*
@@ -112,6 +185,27 @@ static int64_t readlong(FILE *file) {
 		}; \
 	} while (0)
 
+/*
+ * Helper macro for reading names from a file, and errors out if it fails to.
+ * Legacy revisions store them inline, newer ones as IDs into the string table.
+ * @param var The variable to stash the string into
+ * @param file The file to read from. Its position will be advanced
+ * @param ... A format string and related arguments; note that an extra string
+ *            argument is provided, the reason for failure
+ */
+#define tryReadname(var, file, ...) \
+	do { \
+		if (objectRev == RGBDS_OBJECT_REV_LEGACY) { \
+			tryReadstring(var, file, __VA_ARGS__); \
+		} else { \
+			uint32_t tmpID; \
+			tryRead(readvarint, int64_t, INT64_MAX, long, tmpID, file, __VA_ARGS__); \
+			if (tmpID >= objectStrings.size()) \
+				errx(__VA_ARGS__, "Invalid string ID"); \
+			var = objectStrings[tmpID]; \
+		} \
+	} while (0)
+
 // Functions to parse object files
 
 /*
@@ -127,9 +221,9 @@ static void readFileStackNode(
 	FileStackNode &node = fileNodes[i];
 	uint32_t parentID;
 
-	tryReadlong(parentID, file, "%s: Cannot read node #%" PRIu32 "'s parent ID: %s", fileName, i);
+	tryReadsfield(parentID, file, "%s: Cannot read node #%" PRIu32 "'s parent ID: %s", fileName, i);
 	node.parent = parentID != (uint32_t)-1 ? &fileNodes[parentID] : nullptr;
-	tryReadlong(
+	tryReadfield(
 	    node.lineNo, file, "%s: Cannot read node #%" PRIu32 "'s line number: %s", fileName, i
 	);
 	tryGetc(
@@ -144,17 +238,19 @@ static void readFileStackNode(
 	case NODE_FILE:
 	case NODE_MACRO:
 		node.data = "";
-		tryReadstring(
+		tryReadname(
 		    node.name(), file, "%s: Cannot read node #%" PRIu32 "'s file name: %s", fileName, i
 		);
 		break;
 
 		uint32_t depth;
 	case NODE_REPT:
-		tryReadlong(depth, file, "%s: Cannot read node #%" PRIu32 "'s rept depth: %s", fileName, i);
+		tryReadfield(
+		    depth, file, "%s: Cannot read node #%" PRIu32 "'s rept depth: %s", fileName, i
+		);
 		node.data = std::vector<uint32_t>(depth);
 		for (uint32_t k = 0; k < depth; k++)
-			tryReadlong(
+			tryReadfield(
 			    node.iters()[k],
 			    file,
 			    "%s: Cannot read node #%" PRIu32 "'s iter #%" PRIu32 ": %s",
@@ -182,7 +278,7 @@ static void readFileStackNode(
 static void readSymbol(
     FILE *file, Symbol &symbol, char const *fileName, std::vector<FileStackNode> const &fileNodes
 ) {
-	tryReadstring(symbol.name, file, "%s: Cannot read symbol name: %s", fileName);
+	tryReadname(symbol.name, file, "%s: Cannot read symbol name: %s", fileName);
 	tryGetc(
 	    ExportLevel,
 	    symbol.type,
@@ -195,11 +291,11 @@ static void readSymbol(
 	if (symbol.type != SYMTYPE_IMPORT) {
 		symbol.objFileName = fileName;
 		uint32_t nodeID;
-		tryReadlong(
+		tryReadfield(
 		    nodeID, file, "%s: Cannot read \"%s\"'s node ID: %s", fileName, symbol.name.c_str()
 		);
 		symbol.src = &fileNodes[nodeID];
-		tryReadlong(
+		tryReadfield(
 		    symbol.lineNo,
 		    file,
 		    "%s: Cannot read \"%s\"'s line number: %s",
@@ -207,14 +303,14 @@ static void readSymbol(
 		    symbol.name.c_str()
 		);
 		int32_t sectionID, value;
-		tryReadlong(
+		tryReadsfield(
 		    sectionID,
 		    file,
 		    "%s: Cannot read \"%s\"'s section ID: %s",
 		    fileName,
 		    symbol.name.c_str()
 		);
-		tryReadlong(
+		tryReadsfield(
 		    value, file, "%s: Cannot read \"%s\"'s value: %s", fileName, symbol.name.c_str()
 		);
 		if (sectionID == -1) {
@@ -250,7 +346,7 @@ static void readPatch(
 	uint32_t nodeID, rpnSize;
 	PatchType type;
 
-	tryReadlong(
+	tryReadfield(
 	    nodeID,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s node ID: %s",
@@ -259,7 +355,7 @@ static void readPatch(
 	    i
 	);
 	patch.src = &fileNodes[nodeID];
-	tryReadlong(
+	tryReadfield(
 	    patch.lineNo,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s line number: %s",
@@ -267,7 +363,7 @@ static void readPatch(
 	    sectName.c_str(),
 	    i
 	);
-	tryReadlong(
+	tryReadfield(
 	    patch.offset,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s offset: %s",
@@ -275,7 +371,7 @@ static void readPatch(
 	    sectName.c_str(),
 	    i
 	);
-	tryReadlong(
+	tryReadsfield(
 	    patch.pcSectionID,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s PC offset: %s",
@@ -283,7 +379,7 @@ static void readPatch(
 	    sectName.c_str(),
 	    i
 	);
-	tryReadlong(
+	tryReadfield(
 	    patch.pcOffset,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s PC offset: %s",
@@ -301,7 +397,7 @@ static void readPatch(
 	    i
 	);
 	patch.type = type;
-	tryReadlong(
+	tryReadfield(
 	    rpnSize,
 	    file,
 	    "%s: Unable to read \"%s\"'s patch #%" PRIu32 "'s RPN size: %s",
@@ -345,8 +441,8 @@ static void readSection(
 	int32_t tmp;
 	uint8_t byte;
 
-	tryReadstring(section.name, file, "%s: Cannot read section name: %s", fileName);
-	tryReadlong(tmp, file, "%s: Cannot read \"%s\"'s' size: %s", fileName, section.name.c_str());
+	tryReadname(section.name, file, "%s: Cannot read section name: %s", fileName);
+	tryReadfield(tmp, file, "%s: Cannot read \"%s\"'s' size: %s", fileName, section.name.c_str());
 	if (tmp < 0 || tmp > UINT16_MAX)
 		errx("\"%s\"'s section size (%" PRId32 ") is invalid", section.name.c_str(), tmp);
 	section.size = tmp;
@@ -361,14 +457,14 @@ static void readSection(
 		section.modifier = SECTION_FRAGMENT;
 	else
 		section.modifier = SECTION_NORMAL;
-	tryReadlong(tmp, file, "%s: Cannot read \"%s\"'s org: %s", fileName, section.name.c_str());
+	tryReadsfield(tmp, file, "%s: Cannot read \"%s\"'s org: %s", fileName, section.name.c_str());
 	section.isAddressFixed = tmp >= 0;
 	if (tmp > UINT16_MAX) {
 		error(nullptr, 0, "\"%s\"'s org is too large (%" PRId32 ")", section.name.c_str(), tmp);
 		tmp = UINT16_MAX;
 	}
 	section.org = tmp;
-	tryReadlong(tmp, file, "%s: Cannot read \"%s\"'s bank: %s", fileName, section.name.c_str());
+	tryReadsfield(tmp, file, "%s: Cannot read \"%s\"'s bank: %s", fileName, section.name.c_str());
 	section.isBankFixed = tmp >= 0;
 	section.bank = tmp;
 	tryGetc(
@@ -383,7 +479,7 @@ static void readSection(
 		byte = 16;
 	section.isAlignFixed = byte != 0;
 	section.alignMask = (1 << byte) - 1;
-	tryReadlong(
+	tryReadfield(
 	    tmp, file, "%s: Cannot read \"%s\"'s alignment offset: %s", fileName, section.name.c_str()
 	);
 	if (tmp > UINT16_MAX) {
@@ -413,7 +509,7 @@ static void readSection(
 
 		uint32_t nbPatches;
 
-		tryReadlong(
+		tryReadfield(
 		    nbPatches,
 		    file,
 		    "%s: Cannot read \"%s\"'s number of patches: %s",
@@ -466,7 +562,7 @@ static void readAssertion(
 
 	assertName += std::to_string(i);
 	readPatch(file, assert.patch, fileName, assertName, 0, fileNodes);
-	tryReadstring(assert.message, file, "%s: Cannot read assertion's message: %s", fileName);
+	tryReadname(assert.message, file, "%s: Cannot read assertion's message: %s", fileName);
 }
 
 void obj_ReadFile(char const *fileName, unsigned int fileID) {
@@ -522,7 +618,7 @@ void obj_ReadFile(char const *fileName, unsigned int fileID) {
 	uint32_t revNum;
 
 	tryReadlong(revNum, file, "%s: Cannot read revision number: %s", fileName);
-	if (revNum != RGBDS_OBJECT_REV)
+	if (revNum != RGBDS_OBJECT_REV && revNum != RGBDS_OBJECT_REV_LEGACY)
 		errx(
 		    "%s: Unsupported object file for rgblink %s; try rebuilding \"%s\"%s"
 		    " (expected revision %d, got %d)",
@@ -534,16 +630,31 @@ void obj_ReadFile(char const *fileName, unsigned int fileID) {
 		    revNum
 		);
 
+	objectRev = revNum;
+
 	uint32_t nbNodes;
 	uint32_t nbSymbols;
 	uint32_t nbSections;
 
-	tryReadlong(nbSymbols, file, "%s: Cannot read number of symbols: %s", fileName);
-	tryReadlong(nbSections, file, "%s: Cannot read number of sections: %s", fileName);
+	tryReadfield(nbSymbols, file, "%s: Cannot read number of symbols: %s", fileName);
+	tryReadfield(nbSections, file, "%s: Cannot read number of sections: %s", fileName);
 
 	nbSectionsToAssign += nbSections;
 
-	tryReadlong(nbNodes, file, "%s: Cannot read number of nodes: %s", fileName);
+	objectStrings.clear();
+	if (objectRev != RGBDS_OBJECT_REV_LEGACY) {
+		uint32_t nbStrings;
+
+		tryReadfield(nbStrings, file, "%s: Cannot read number of strings: %s", fileName);
+		objectStrings.resize(nbStrings);
+		verbosePrint("Reading %" PRIu32 " strings...\n", nbStrings);
+		for (uint32_t i = 0; i < nbStrings; i++)
+			tryReadstring(
+			    objectStrings[i], file, "%s: Cannot read string #%" PRIu32 ": %s", fileName, i
+			);
+	}
+
+	tryReadfield(nbNodes, file, "%s: Cannot read number of nodes: %s", fileName);
 	nodes[fileID].resize(nbNodes);
 	verbosePrint("Reading %u nodes...\n", nbNodes);
 	for (uint32_t i = nbNodes; i--;)
@@ -581,7 +692,7 @@ void obj_ReadFile(char const *fileName, unsigned int fileID) {
 
 	uint32_t nbAsserts;
 
-	tryReadlong(nbAsserts, file, "%s: Cannot read number of assertions: %s", fileName);
+	tryReadfield(nbAsserts, file, "%s: Cannot read number of assertions: %s", fileName);
 	verbosePrint("Reading %" PRIu32 " assertions...\n", nbAsserts);
 	for (uint32_t i = 0; i < nbAsserts; i++) {
 		Assertion &assertion = assertions.emplace_front();
@@ -0,0 +1,5 @@
+; `-D !4000000000=1` must not make room for 4 billion anonymous labels
+
+SECTION "anon", ROM0
+:
+	jr :-
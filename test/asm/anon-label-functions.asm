@@ -0,0 +1,9 @@
+; Anonymous label references work in functions too, before and after the labels exist
+
+SECTION "anon", ROM0
+	assert !DEF(:+) && BANK(:+) == 0
+:
+	assert DEF(:-) && !DEF(:+)
+	println SECTION(:-)
+	db BANK(:-), BANK(:+)
+:
@@ -0,0 +1,15 @@
+; REPT and MACRO bodies can be captured from within expansions...
+DEF rept_in_equs EQUS "REPT 2\n\tPRINTLN \"REPT in EQUS\"\nENDR"
+	rept_in_equs
+
+MACRO def_macro
+	\1
+ENDM
+	def_macro MACRO inner\n\tPRINTLN "inner macro"\nENDM
+	inner
+
+; ...and they may continue past the end of the expansion
+DEF rept_start EQUS "REPT 2\n\tPRINTLN \"REPT started in EQUS\"\n"
+	rept_start
+	PRINTLN "REPT ended in file"
+ENDR
@@ -0,0 +1,24 @@
+newcharmap base
+charmap "a", 1
+charmap "ab", 2
+
+; 'derived' shares 'base' mappings until either is modified
+newcharmap derived, base
+assert incharmap("a") && incharmap("ab")
+charmap "abc", 3
+charmap "b", 4
+
+setcharmap base
+assert !incharmap("abc") ; only in 'derived'
+assert !incharmap("b") ; only in 'derived'
+charmap "c", 5
+
+setcharmap derived
+assert incharmap("abc")
+assert !incharmap("c") ; only in 'base'
+
+; 'other' keeps sharing 'base' mappings
+newcharmap other, base
+assert incharmap("c")
+assert !incharmap("b")
+assert charlen("abc") == 2
@@ -0,0 +1,11 @@
+SECTION "Slices", ROM0
+
+; Every slice of the same file reads from a single copy of it
+INCBIN "data.bin", 10, 5
+INCBIN "data.bin", 0, 3
+INCBIN "data.bin", 120
+INCBIN "data.bin", 10, 5
+
+; Empty files, or empty ends of files, have nothing to copy
+INCBIN "empty.bin"
+INCBIN "data.bin", 123
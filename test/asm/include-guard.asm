@@ -0,0 +1,21 @@
+INCLUDE "include-guard.inc"
+INCLUDE "include-guard.inc"
+PURGE INCLUDE_GUARD_INC
+INCLUDE "include-guard.inc"
+
+INCLUDE "include-guard-else.inc"
+INCLUDE "include-guard-else.inc"
+
+INCLUDE "include-guard-elif.inc"
+INCLUDE "include-guard-elif.inc"
+INCLUDE "include-guard-elif.inc"
+
+INCLUDE "include-guard-trailing.inc"
+INCLUDE "include-guard-trailing.inc"
+
+MACRO include_with_guard
+	INCLUDE "include-guard-arg.inc"
+ENDM
+	include_with_guard FIRST_GUARD
+	include_with_guard SECOND_GUARD
+	include_with_guard FIRST_GUARD
@@ -0,0 +1,26 @@
+; Each REPT/FOR iteration must lex its body anew,
+; since what the same text lexes to can change between iterations
+
+DEF op EQUS "PRINT"
+DEF n = 0
+REPT 3
+	op "{d:n} "     ; `op` is a different EQUS every iteration
+	REDEF op EQUS "PRINTLN"
+	PRINTLN "\@"    ; `\@` is unique to each iteration
+	DEF n += %10    ; The binary digits are swapped after the first iteration
+	OPT b10
+ENDR
+OPT b01
+PRINTLN "n = {d:n}"
+
+MACRO m
+	REPT _NARG
+		PRINTLN "\1" ; `\1` changes with each SHIFT
+		SHIFT
+	ENDR
+ENDM
+	m one, two, three
+
+FOR I, 3
+	PRINTLN STRCAT("{d:I}", " is ", STRSUB("even odd", I % 2 * 5 + 1, 4 - I % 2))
+ENDR
@@ -0,0 +1,23 @@
+SECTION "Floating", ROM0
+
+Start:
+	ds 5
+End:
+	; Label differences are constant even with offsets on either side
+	println End + 3 - (Start + 1)
+	println (End - 1) - Start
+	println End - (Start - 2) + 1
+
+	; Constant terms are folded, so these patches only add one constant
+	dw End + 3 + 4 - 1
+	dw 2 + End - 2
+	db LOW(End - 7 + 8)
+
+SECTION "Aligned", ROM0, ALIGN[8, 2]
+
+	ds 3
+Aligned:
+	; The low byte of aligned labels is known, even with an offset
+	println LOW(Aligned)
+	println LOW(Aligned + $10)
+	println (Aligned + 1) & $7F
@@ -0,0 +1,38 @@
+; Skipped blocks and captured bodies must keep track of lines and nesting
+IF 0
+	db 1, 2, 3 ; endc
+	ld a, \
+ENDC
+	ifdef ; not a keyword
+	If 0
+		ELSE ; nested
+	eNdC
+	dw "\\" ; escaped backslash
+ELIF 1
+	WARN "taken ELIF"
+ELSE
+	WARN "untaken ELSE"
+ENDC
+
+MACRO mac
+	endmacro ; not ENDM
+	WARN "in macro"
+	   ENDM
+	mac
+
+REPT 2
+	FOR V, 1 ; nested
+		WARN "in rept"
+	ENDR ; endr
+	REPTile
+ENDR
+
+REPT 3
+	IF 1
+		BREAK
+		FOR V, 1
+	ENDR
+	ENDC
+	WARN "unreached"
+ENDR
+WARN "done"
@@ -128,6 +128,52 @@ for i in *.asm; do
 	done
 done
 
+# Check that the object file cache reuses objects, until an `INCBIN`ned file changes,
+# and only when it can
+(( tests++ ))
+echo "${bold}${green}cache...${rescolors}${resbold}"
+cachedir="$(mktemp -d)"
+printf 'SECTION "cache", ROM0\nINCBIN "%s/data.bin"\n' "$cachedir" >"$cachedir/cache.asm"
+printf 'abc' >"$cachedir/data.bin"
+our_rc=0
+"$RGBASM" -v -C "$cachedir" -o "$o" "$cachedir/cache.asm" | grep -q "^Stored cache entry" || our_rc=1
+cp "$o" "$gb"
+"$RGBASM" -v -C "$cachedir" -o "$o" "$cachedir/cache.asm" | grep -q "^Cache hit" || our_rc=1
+cmp "$gb" "$o" || our_rc=1
+printf 'abd' >"$cachedir/data.bin"
+"$RGBASM" -v -C "$cachedir" -o "$o" "$cachedir/cache.asm" | grep -q "^Cache miss" || our_rc=1
+cmp -s "$gb" "$o" && our_rc=1
+# Objects are not cached if the current time is used, even indirectly, or if anything is printed
+printf 'SECTION "time", ROM0\nDEF T EQUS STRCAT("__TI", "ME__")\ndb T\n' >"$cachedir/time.asm"
+"$RGBASM" -v -C "$cachedir" -o "$o" "$cachedir/time.asm" | grep -q "^Not caching" || our_rc=1
+printf 'PRINTLN "Hello"\n' >"$cachedir/print.asm"
+"$RGBASM" -v -C "$cachedir" -o "$o" "$cachedir/print.asm" | grep -q "^Not caching" || our_rc=1
+rm -rf "$cachedir"
+if [[ $our_rc -ne 0 ]]; then
+	echo "${bold}${red}cache mismatch!${rescolors}${resbold}"
+	(( failed++ ))
+	rc=1
+fi
+
+# Check that object files are written through symbolic links, without touching unrelated files
+(( tests++ ))
+echo "${bold}${green}object file replacement...${rescolors}${resbold}"
+outdir="$(mktemp -d)"
+printf 'SECTION "out", ROM0\ndb 42\n' >"$outdir/out.asm"
+printf 'keep' >"$outdir/real.o.tmp"
+ln -s real.o "$outdir/link.o"
+our_rc=0
+"$RGBASM" -o "$outdir/link.o" "$outdir/out.asm" || our_rc=1
+"$RGBASM" -o "$outdir/link.o" "$outdir/out.asm" || our_rc=1
+[[ -L "$outdir/link.o" && -f "$outdir/real.o" ]] || our_rc=1
+[[ "$(cat "$outdir/real.o.tmp")" = keep ]] || our_rc=1
+rm -rf "$outdir"
+if [[ $our_rc -ne 0 ]]; then
+	echo "${bold}${red}object file replacement mismatch!${rescolors}${resbold}"
+	(( failed++ ))
+	rc=1
+fi
+
 if [[ "$failed" -eq 0 ]]; then
 	echo "${bold}${green}All ${tests} tests passed!${rescolors}${resbold}"
 else
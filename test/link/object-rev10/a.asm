@@ -0,0 +1,25 @@
+; a.o was assembled from this file in object revision 10, whose strings are inlined
+
+MACRO table
+	REPT \1
+		assert WARN, @ != .local + 1, "Second entry of the table"
+		db \2
+	ENDR
+ENDM
+
+SECTION "Legacy", ROM0[$0000]
+LegacyEntry::
+	ld hl, Modern
+	call ModernFunc
+	jr .local
+.local::
+	table 3, LOW(Modern)
+	dw LegacyData
+	assert Modern != LegacyEntry, "Modern code overlaps legacy code"
+
+SECTION FRAGMENT "Shared", ROM0
+LegacyData::
+	db BANK(@), "legacy"
+
+SECTION "Legacy RAM", WRAM0
+wLegacy:: ds 2
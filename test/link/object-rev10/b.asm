@@ -0,0 +1,13 @@
+SECTION "Modern", ROM0
+Modern::
+	dw LegacyEntry, LegacyEntry.local
+ModernFunc::
+	ld a, [wLegacy]
+	ld [wModern], a
+	ret
+
+SECTION FRAGMENT "Shared", ROM0
+	db BANK(LegacyData), "modern"
+
+SECTION "Modern RAM", WRAM0
+wModern:: ds 1
@@ -0,0 +1,13 @@
+SECTION "test", ROM0
+
+MACRO iterate
+	REPT 2
+		assert FAIL, @ == -1, "Iteration {d:iter}"
+		DEF iter += 1
+	ENDR
+ENDM
+
+DEF iter = 1
+; Both invocations start on the same line, so their file stack nodes are shared
+DEF iterate_twice EQUS "iterate\n\titerate"
+	iterate_twice